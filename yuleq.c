@@ -26,7 +26,14 @@
 // - portaudio library
 //
 // Compile
-//     gcc -Wall -O2 -lportaudio -lm yuleq.c -o yuleq
+//     gcc -Wall -O2 -lportaudio -lm -lpthread yuleq.c -o yuleq
+//
+// Debug build, aborts on allocation or locking in the audio thread (glibc)
+//     gcc -Wall -O2 -g -rdynamic -DRT_DEBUG -lportaudio -lm -lpthread -ldl yuleq.c -o yuleq
+
+#ifdef RT_DEBUG
+#define _GNU_SOURCE
+#endif
 
 #ifdef _WIN32
 #define _CRT_SECURE_NO_WARNINGS
@@ -35,6 +42,16 @@
 #include <consoleapi.h>
 #include <io.h>
 #else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <pthread.h>
 #include <termios.h>
 #include <unistd.h>
 #endif
@@ -42,12 +59,23 @@
 #include <math.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef RT_DEBUG
+#include <dlfcn.h>
+#include <execinfo.h>
+#endif
+
 #include <portaudio.h>
 
 
@@ -56,6 +84,55 @@
 #define STEP       50       // loop adjustment step in ms
 #define LATENCY    20       // audio buffer size in ms
 #define CHUNK_SIZE 0x100000 // slurp chunk size in bytes
+#define CACHE_SIZE 4096     // default decode cache limit in MB
+#define CACHE_HEAD 0x10000  // cache entry header size, multiple of page size
+#define CACHE_TEMP 3600     // age in s after which stale temp files are removed
+#define DAEMON_READ 5       // s a daemon client has to send its request
+#define BOOKMARKS  10       // number of loop bookmarks
+#define WATCH      1        // watch directory poll interval in s
+#define LOAD_BINS  200      // callback load histogram bins of 1 %
+#define SCAN_BLOCK 256      // frames per block in level scan
+#define TP_TAPS    16       // true peak interpolation taps per phase
+#define TP_PHASES  4        // true peak oversampling factor
+#define SILENCE    1e-4     // non-silent sample threshold (-80 dBFS)
+#define DC_LIMIT   1e-3     // dc offset warning threshold (-60 dBFS)
+#define ALIGN_MS   1        // start offset warning threshold in ms
+#define DRIFT_SIZE 0x10000  // drift measurement window in frames
+#define DRIFT_NUM  32       // drift measurements across the track
+#define DRIFT_MIN  0.05     // min correlation of a valid measurement
+#define DRIFT_PPM  0.1      // smallest corrected drift in ppm
+#define SINC_TAPS  32       // resampler taps per side
+#define ANALYSIS   "yuleqa1"  // analysis result format and version
+#define EXPORT     "yuleqx1"  // shared memory export format and version
+#define SPEC_SIZE  4096     // spectrum analysis frame size
+#define MATRIX_BLOCK 4096   // frames of every file in cache while compared against all others
+#define FP_SIZE    2048     // fingerprint spectrum frame size
+#define FP_HOP     1024     // fingerprint frame distance
+#define FP_FAN     3        // peaks paired with each anchor peak
+#define FP_SPAN    15       // max frames between paired peaks
+#define FP_COMMON  200      // hashes found more often in the index are ignored
+#define FP_VOTES   10       // min hashes at one offset to match a reference
+#define DIFF_BLOCK 1000     // difference ranking block in ms
+#define DIFF_TOP   10       // passages in difference ranking
+#define DIFF_EMPH  0.95f    // pre-emphasis of difference with -e
+#define SEAM_RANGE 50       // loop end search range in ms
+#define ARENA_CHUNK 0x100000 // audio thread memory chunk size in bytes
+#define GOV_HIGH   70       // callback load in % that sheds the next stage
+#define GOV_LOW    35       // callback load in % that counts as headroom
+#define GOV_HOLD   25       // callbacks between governor changes
+#define GOV_CALM   250      // callbacks with headroom before a stage is restored
+#define HASH_CHUNK 0x100000 // bytes per leaf of content hash
+#define DELTA_BLOCK 1024   // frames per independently coded residual block
+#define DELTA_SCALE 8388608.0f // residual quantization, 24 bit resolution
+#define DELTA_ESC  24       // rice quotient escape to raw value
+#define DEDUP_BLOCK 4096   // frames per deduplicated block
+#define PLANE_ALIGN 64     // channel plane alignment in bytes
+#define PLANE_GUARD 16     // zero frames before and after each channel plane
+#define CONV_TAPS  0x10000  // max filter length in taps
+#define EVENTS     64       // scheduled switch queue size, power of two
+#define CONV_HEAD  2        // filter partitions convolved in the callback
+#define CONV_WAIT  0.25     // longest callback wait for the tail worker, in buffers
+#define SINC_RES   1024     // resampler kernel phases
 #define HELP       "\
 yu’egh leQ - compare audio files\n\
 https://github.com/chuvok/yuleq\n\
@@ -69,10 +146,26 @@ options\n\
     -d n audio device index\n\
     -o n output samplerate\n\
     -v   verbose output\n\
+    -c d decode cache directory\n\
+    -m n decode cache limit in MB\n\
+    -w d add new files from directory while playing\n\
+    -s   print memory and performance statistics\n\
+    -t   compensate delay and clock drift against first file\n\
+    -f f convolve output with filter from audio file\n\
+    -p f render to headphones with impulse response pairs from audio file\n\
+    -e   weight differences towards high frequencies\n\
+    -a   analyze files against first file and exit\n\
+    -n   analyze differences between all pairs of files and exit\n\
+    -g d analyze files against matching reference from directory and exit\n\
+    -k   run daemon that keeps decoded files in shared memory\n\
+    -u   load files through daemon\n\
+    -z s storage of compared files: delta, dedup, planar\n\
+    -x   export played audio to shared memory\n\
 files\n\
-    one or more audio fiels\n"
+    one or more audio fiels, - for stdin, fd:n for file descriptor n\n"
 
 #define PANIC(...) do {printf(__VA_ARGS__); exit(1);} while (0)
+#define WARN(...)  do {printf(__VA_ARGS__); warnings += 1;} while (0)
 
 #ifdef  _WIN32
 #undef  min
@@ -83,15 +176,36 @@ files\n\
 #define write       _write
 #endif
 
+#ifdef _WIN32
+typedef HANDLE thread_t;
+#else
+typedef pthread_t thread_t;
+#endif
+
 struct arg {
     bool  list_devices;
     bool  blind;
     bool  refblind;
     int   device_index;
     int   device_rate;
-    char* files[MAX_TRACKS];
+    char** files;
     int   num_files;
     bool  verbose;
+    char* cache_dir;
+    int   cache_size;
+    char* watch_dir;
+    bool  stats;
+    bool  drift;
+    char* filter;
+    char* hrir;
+    bool  emphasis;
+    bool  analyze;
+    bool  matrix;
+    char* ref_dir;
+    bool  daemon;
+    bool  use_daemon;
+    int   storage;
+    bool  export;
 };
 
 struct buffer {
@@ -99,12 +213,305 @@ struct buffer {
     int   size;
 };
 
+enum storage {
+    STORAGE_HEAP,      // private heap buffer
+    STORAGE_CACHE,     // shared mapping of a decode cache entry
+    STORAGE_DELTA,     // coded residual against reference track
+    STORAGE_DEDUP,     // blocks shared with other tracks
+    STORAGE_PLANAR,    // aligned channel planes
+};
+
+enum stage {
+    STAGE_PROBE,       // ffprobe
+    STAGE_DECODE,      // ffmpeg
+    STAGE_CACHE,       // cache lookup, store and mapping
+    STAGE_PAD,         // zero padding
+    STAGE_SCAN,        // level scan
+    STAGE_HASH,        // content hash
+    STAGE_CODE,        // storage coding
+    STAGES,
+};
+
+struct cpx {
+    float re;
+    float im;
+};
+
+// real fft of size n, mixed radix, complex transform of size n / 2 inside
+struct fft {
+    int         n;            // real size
+    bool        inverse;      // inverse transform, unscaled
+    int         factors[64];  // radix and remaining size per stage
+    struct cpx* twiddles;     // complex transform twiddles
+    struct cpx* super;        // real split twiddles
+    struct cpx* tmp;          // complex work buffer
+    struct cpx* scratch;      // generic butterfly buffer
+};
+
+struct scan {
+    float  peak;       // sample peak
+    float  true_peak;  // oversampled peak
+    int    clips;      // samples at or beyond full scale
+    int    dc_channel; // channel with largest dc offset
+    double dc;         // largest dc offset
+    int    first;      // first non-silent frame
+    int    last;       // last non-silent frame
+};
+
+struct scanner {
+    struct scan* r;
+    int          ch;       // channels
+    int          done;     // frames scanned
+    double*      sum;      // channel sums
+    float        gain;     // max filter gain, bounds inter-sample overshoot
+    float        taps[TP_PHASES * TP_TAPS];
+    double       time;     // time spent scanning in s
+};
+
+// rice coded residual against a reference, in blocks that decode independently
+struct delta {
+    struct track* ref;        // reference track, NULL if not coded
+    int           ref_frames; // reference frames including padding
+    int           frames;     // coded frames including padding
+    uint64_t*     bits;       // coded blocks
+    size_t*       offset;     // bit offset of each block
+    uint8_t*      param;      // rice parameter of each block
+    size_t        size;       // coded size in bytes
+};
+
+// track split into blocks, identical blocks of all tracks are stored once
+struct blocks {
+    float**   data;   // block pointers into the shared pool
+    uint64_t* hash;   // content hash per block
+    int       count;
+    int       unique; // blocks first stored by this track
+};
+
+struct pool_entry {
+    uint64_t hash;
+    float*   data;  // NULL for removed entry
+    int      refs;  // tracks referencing the block
+};
+
+// shared block store, open addressing hash table
+struct pool {
+    struct pool_entry* slots;
+    int                size; // power of two
+    int                used; // slots ever filled since last rehash
+};
+
+// channels in separate aligned planes, zero guard frames on both sides of each
+struct planes {
+    float* buf;    // allocation
+    float* data;   // first frame of first channel
+    size_t stride; // floats from one channel to the next
+};
+
+// playback pcm in shared memory, replaces heap buffer of heap and planar storage
+struct shared {
+    char   name[32]; // shared memory object, empty if not exported
+    void*  base;     // mapping
+    size_t size;
+};
+
 struct track {
-    float* pcm;        // interleaved channels
+    float* pcm;        // interleaved channels, NULL if coded, split or planar
     char*  name;       // file name
     int    channels;   // source channels
     int    samplerate; // source samplerate
     int    length;     // total frames in buffer
+    int    storage;    // buffer storage type
+    int    fd;         // cache entry file descriptor
+    size_t mapped;     // size of cache entry mapping
+    double time[STAGES]; // load time per stage in s
+    struct scan scan;  // levels found at load
+    uint64_t    hash;  // content hash of decoded pcm
+    struct delta delta; // coded storage
+    struct blocks blocks; // deduplicated storage
+    struct planes planes; // planar storage
+    struct shared shared; // export for external tools
+};
+
+// export of one track slot, all sizes in bytes
+struct export_track {
+    char    name[32];  // shared memory object with pcm, empty if slot is unused
+    char    file[256]; // input file, empty in blind tests
+    int32_t planar;    // channels in planes instead of interleaved
+    int32_t frames;    // frames including zero padding
+    int64_t offset;    // first sample of first channel
+    int64_t stride;    // first channel to second channel, planar only
+};
+
+// shared memory export descriptor, updated while playing
+struct export_head {
+    char                magic[8];  // EXPORT
+    uint32_t            sequence;  // odd while being updated
+    int32_t             samplerate;
+    int32_t             channels;
+    int32_t             length;    // frames without padding
+    int32_t             track;     // current slot
+    int32_t             pos;       // playback position in frames
+    int32_t             start;     // loop start
+    int32_t             end;       // loop end
+    struct export_track tracks[MAX_TRACKS];
+};
+
+struct cache_header {
+    char        magic[8]; // "yuleq" and format version
+    int         channels;
+    int         samplerate;
+    int         length;
+    struct scan scan;
+    uint64_t    hash;     // content hash of pcm
+};
+
+// track slots, replaced as a whole when tracks are added or removed
+struct table {
+    struct track* tracks[MAX_TRACKS]; // NULL for empty slot
+};
+
+// background track loader
+struct loader {
+    char*        name;  // file being loaded
+    struct track track; // loaded track
+    atomic_bool  done;  // set when track is loaded
+    bool         busy;  // true while thread is running
+    thread_t     thread;
+    char*        queue[MAX_TRACKS];
+    int          queued;
+};
+
+// background search for the loop end that best continues at loop start
+struct seam {
+    float*       a;     // reference around candidate ends
+    float*       b;     // reference around loop start
+    int          start; // loop start at request
+    int          end;   // loop end at request
+    int          first; // first candidate end
+    int          count; // candidate ends
+    int          len;   // compared samples, both sides of the seam
+    int          best;  // best end
+    double       score; // normalized cross-correlation of best end
+    atomic_bool  done;  // set when search is finished
+    bool         busy;  // true while thread is running
+    thread_t     thread;
+};
+
+// background ranking of passages that differ most from the reference
+struct diff {
+    _Atomic(float)* score[MAX_TRACKS]; // difference level per block in dB, NAN until done
+    struct track*   of[MAX_TRACKS];    // tracks the scores belong to
+    struct track*   ref;               // reference the scores belong to
+    int             blocks;            // blocks per track
+    atomic_int      next;              // next block to analyze
+    atomic_bool     cancel;            // stop analysis
+    int             threads;           // running threads
+    thread_t        thread[64];
+    struct table*   tab;               // table being analyzed
+    int             rank;              // last passage shown
+};
+
+struct watch {
+    char* path;         // file in watch directory
+    long  size;         // file size at last poll
+    bool  added;        // true when queued for loading
+};
+
+// audio backend setup, runs while tracks are decoded
+struct audio {
+    atomic_int  samplerate; // stream format, 0 until first track is loaded
+    atomic_int  outputs;
+    thread_t    thread;
+};
+
+struct stats {
+    double      init;      // audio init time in s
+    double      load;      // track load time in s
+    double      open;      // stream open time in s
+    double      wait;      // time playback waited for audio setup in s
+    atomic_uint load_hist[LOAD_BINS]; // callback time in % of buffer duration
+    atomic_uint underruns; // output underflows reported by portaudio
+    atomic_uint late;      // filter tails the worker did not finish in time
+};
+
+struct bookmark {
+    int    start;      // loop start
+    int    end;        // loop end
+    bool   set;        // true when stored
+};
+
+// uniformly partitioned overlap-save convolution, partition size is the buffer size
+struct conv {
+    int         size;      // partition size in frames
+    int         parts;     // filter partitions, 0 if off
+    int         bins;      // spectrum bins, padded to 4
+    int         slots;     // input spectra kept
+    int         inputs;    // input channels
+    int         outputs;   // output channels
+    int         filters;   // filter channels
+    bool        matrix;    // filter i * outputs + o maps input i to output o, else o % filters maps o to o
+    float*      h;         // filter spectra [filter][part][re, im][bins]
+    float*      x;         // input spectra [input][slot][re, im][bins]
+    float*      tail;      // tail sums [block % (CONV_HEAD + 1)][output][re, im][bins]
+    float*      lo;        // tail sums at the shorter cut of a quality change, same layout
+    float*      fade;      // output at the previous quality [size][output]
+    float*      win;       // crossfade window [size]
+    float*      acc;       // callback sum [re, im][bins]
+    float*      in;        // last two input blocks [input][2 * size]
+    float*      buf;       // time domain work buffer
+    struct cpx* spec;      // spectrum work buffer
+    struct fft* fwd;
+    struct fft* inv;
+    atomic_int  avail;     // last block with input spectra stored
+    atomic_int  claimed;   // last block with tail sum started
+    atomic_int  done;      // last block with tail sum finished by worker
+    atomic_int  quality;   // 2 full, 1 half tail, 0 no tail, -1 bypassed, set by governor
+    atomic_int  computed;  // quality of the last tail sum started
+    int         tail_q[CONV_HEAD + 1];  // quality of each tail sum
+    int         tail_lo[CONV_HEAD + 1]; // partitions in lo
+    int         tail_hi[CONV_HEAD + 1]; // partitions in tail
+    int         played;    // quality of the last output
+    int         block;     // current block
+};
+
+// optional processing given up under deadline pressure, in order
+struct shed {
+    struct conv* cv;
+    int          quality;  // conv quality after shedding
+    const char*  name;
+};
+
+// memory touched by the audio thread, prefaulted and locked when the stream starts
+struct arena {
+    char*  chunks[64];  // allocated chunks
+    size_t sizes[64];   // chunk sizes
+    int    count;       // chunks in use
+    size_t used;        // bytes used in last chunk
+    bool   sealed;      // no more allocations after stream start
+};
+
+// callback deadline governor
+struct governor {
+    atomic_int level;      // sheds applied
+    int        hold;       // callbacks until next change is allowed
+    int        calm;       // consecutive callbacks with headroom
+    int        shown;      // level reported on screen
+};
+
+// track switch queued by the main thread
+struct event {
+    int  track; // slot to switch to
+    bool wrap;  // at the next loop seam instead of the next buffer
+};
+
+// single producer, single consumer queue of switches executed by the audio thread
+struct events {
+    struct event queue[EVENTS];
+    atomic_uint  head;  // next event to execute, written by audio thread
+    atomic_uint  tail;  // next free entry, written by main thread
+    atomic_bool  flush; // drop pending events, cleared by audio thread
+    bool         cycle; // cycle through all tracks, one loop each
+    int          last;  // target of last queued cycle switch
 };
 
 struct player {
@@ -113,19 +520,118 @@ struct player {
     int    pos;        // track position
     int    start;      // loop start
     int    end;        // loop end
+    int    seek;       // requested position or -1
     int    length;     // total length in samples
-    int    channels;   // output channels
+    int    channels;   // track channels
+    int    outputs;    // output channels
     int    samplerate; // output samplerate
     bool   running;    // running flag
     bool   paused;     // true when paused
     float* window;     // fade window coefficients
+    float* mix;        // track channel buffer when rendering binaural
+    float* span;       // decoded track frames for windowing
+};
+
+
+static PaStream*              stream;
+static struct arg             arg;
+static struct player          player;
+static _Atomic(struct table*) table;   // published track table
+static atomic_uint            epoch;   // completed audio callbacks
+static struct loader          loader;
+static struct seam            seam;
+static struct diff            diff;
+static struct watch*          watched;
+static int                    num_watched;
+static struct bookmark        bookmarks[BOOKMARKS];
+static struct stats           stats;
+static struct audio           audio;
+static struct conv            binaural;   // track channels to headphones
+static struct conv            correction; // output filter
+static struct governor        governor;
+static struct arena           arena;
+static struct pool            pool;
+static struct events          events;
+static struct export_head*    exported; // shared memory descriptor with -x
+static bool                   stdin_read; // stdin carried audio, keys come from the terminal
+
+static const struct shed sheds[] = {
+    {&correction, 1, "correction filter tail halved"},
+    {&correction, 0, "correction filter tail off"},
+    {&binaural, 1, "headphone rendering tail halved"},
+    {&binaural, 0, "headphone rendering tail off"},
+    {&correction, -1, "correction filter off"},
 };
+#define SHEDS ((int)(sizeof(sheds) / sizeof(*sheds)))
+
+#ifdef RT_DEBUG
+#ifndef __GLIBC__
+#error "RT_DEBUG needs glibc"
+#endif
+
+// trap allocation and locking on real-time threads
+static _Thread_local bool rt_thread;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void  __libc_free(void* ptr);
+
+static void rt_trap(const char* fn) {
+    void* frames[64];
+    rt_thread = false; // backtrace and printf may allocate
+    printf("\n%s called on audio thread\n", fn);
+    fflush(stdout);
+    backtrace_symbols_fd(frames, backtrace(frames, 64), 1);
+    abort();
+}
+
+void* malloc(size_t size) {
+    if (rt_thread) {
+        rt_trap("malloc");
+    }
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    if (rt_thread) {
+        rt_trap("calloc");
+    }
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (rt_thread) {
+        rt_trap("realloc");
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    if (rt_thread) {
+        rt_trap("free");
+    }
+    __libc_free(ptr);
+}
 
+int pthread_mutex_lock(pthread_mutex_t* m) {
+    static int (*lock)(pthread_mutex_t*);
+    if (rt_thread) {
+        rt_trap("pthread_mutex_lock");
+    }
+    if (!lock) {
+        lock = (int (*)(pthread_mutex_t*))dlsym(RTLD_NEXT, "pthread_mutex_lock");
+    }
+    return lock(m);
+}
 
-static PaStream*     stream;
-static struct arg    arg;
-static struct player player;
-static struct track  tracks[MAX_TRACKS];
+#define RT_ENTER() (rt_thread = true)
+#define RT_LEAVE() (rt_thread = false)
+#else
+#define RT_ENTER()
+#define RT_LEAVE()
+#endif
+static int                    warnings; // load warnings, keep them on screen
 
 
 static int min(int a, int b) {
@@ -144,10 +650,11 @@ static bool isbig(void) {
 
 static void parse_args(int argc, char** argv) {
     for (int i = 0; i < argc; i++) {
-        // file args
-        if (argv[i][0] != '-') {
-            if (arg.num_files >= MAX_TRACKS) {
-                PANIC("too many files\n");
+        // file args, single - is stdin
+        if (argv[i][0] != '-' || !argv[i][1]) {
+            arg.files = realloc(arg.files, (arg.num_files + 1) * sizeof(char*));
+            if (!arg.files) {
+                PANIC("out of memory\n");
             }
             arg.files[arg.num_files] = argv[i];
             arg.num_files += 1;
@@ -173,6 +680,49 @@ static void parse_args(int argc, char** argv) {
             arg.blind = true;
         } else if (flag == 'r') {
             arg.refblind = true;
+        } else if (flag == 'a') {
+            arg.analyze = true;
+        } else if (flag == 'n') {
+            arg.analyze = true;
+            arg.matrix  = true;
+        } else if (flag == 'g') {
+#ifdef _WIN32
+            PANIC("reference directory not supported on this platform\n");
+#endif
+            if (!*value) {
+                PANIC("missing reference directory\n");
+            }
+            arg.analyze = true;
+            arg.ref_dir = value;
+            i += !argv[i][2];
+        } else if (flag == 'z') {
+            if (!strcmp(value, "delta")) {
+                arg.storage = STORAGE_DELTA;
+            } else if (!strcmp(value, "dedup")) {
+                arg.storage = STORAGE_DEDUP;
+            } else if (!strcmp(value, "planar")) {
+                arg.storage = STORAGE_PLANAR;
+            } else {
+                PANIC("unknown storage: '%s'\n", value);
+            }
+            i += !argv[i][2];
+        } else if (flag == 'k' || flag == 'u') {
+#ifdef _WIN32
+            PANIC("daemon not supported on this platform\n");
+#endif
+            arg.daemon     |= flag == 'k';
+            arg.use_daemon |= flag == 'u';
+        } else if (flag == 'x') {
+#ifdef _WIN32
+            PANIC("export not supported on this platform\n");
+#endif
+            arg.export = true;
+        } else if (flag == 'e') {
+            arg.emphasis = true;
+        } else if (flag == 's') {
+            arg.stats = true;
+        } else if (flag == 't') {
+            arg.drift = true;
         } else if (flag == 'l') {
             arg.list_devices = true;
         } else if (flag == 'd') {
@@ -189,6 +739,43 @@ static void parse_args(int argc, char** argv) {
                 PANIC("invalid samplerate: '%s'\n", value);
             }
             i += !argv[i][2];
+        } else if (flag == 'c') {
+#ifdef _WIN32
+            PANIC("decode cache not supported on this platform\n");
+#endif
+            if (!*value) {
+                PANIC("missing cache directory\n");
+            }
+            arg.cache_dir = value;
+            i += !argv[i][2];
+        } else if (flag == 'f') {
+            if (!*value) {
+                PANIC("missing filter file\n");
+            }
+            arg.filter = value;
+            i += !argv[i][2];
+        } else if (flag == 'p') {
+            if (!*value) {
+                PANIC("missing impulse response file\n");
+            }
+            arg.hrir = value;
+            i += !argv[i][2];
+        } else if (flag == 'w') {
+#ifdef _WIN32
+            PANIC("watch mode not supported on this platform\n");
+#endif
+            if (!*value) {
+                PANIC("missing watch directory\n");
+            }
+            arg.watch_dir = value;
+            i += !argv[i][2];
+        } else if (flag == 'm') {
+            char* endptr = NULL;
+            arg.cache_size = strtol(value, &endptr, 10);
+            if (endptr == value || arg.cache_size <= 0) {
+                PANIC("invalid cache size: '%s'\n", value);
+            }
+            i += !argv[i][2];
         } else {
             PANIC("unknown option: %s\n", argv[i]);
         }
@@ -203,397 +790,4583 @@ static void* alloc(void* ptr, size_t size) {
     return ptr;
 }
 
-// generate cross-fade window
-static void gen_window(void) {
-    int ch     = player.channels;
-    int n      = LATENCY * player.samplerate / 1000;
-    float* win = alloc(player.window, n * ch * sizeof(float));
-
-    for (int i = 0; i < n; i++) {
-        double w = 0.5 + 0.5 * cos(M_PI * i / n);
-        for (int c = 0; c < ch; c++) {
-            win[i * ch + c] = (float)w;
+// zeroed memory for the audio thread, only before the stream starts
+static void* rt_alloc(size_t size) {
+    size = (size + 63) & ~(size_t)63;
+    if (arena.sealed) {
+        PANIC("audio memory allocated after stream start\n");
+    }
+    if (!arena.count || arena.used + size > arena.sizes[arena.count - 1]) {
+        if (arena.count == (int)(sizeof(arena.chunks) / sizeof(*arena.chunks))) {
+            PANIC("out of audio memory\n");
         }
+        // zeroing faults in every page of the chunk
+        size_t chunk = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        arena.chunks[arena.count] = memset(alloc(NULL, chunk), 0, chunk);
+        arena.sizes[arena.count]  = chunk;
+        arena.count += 1;
+        arena.used = 0;
     }
-    player.window = win;
+    char* p = arena.chunks[arena.count - 1] + arena.used;
+    arena.used += size;
+    return p;
 }
 
-// cross-fade out to in using window
-static void apply_window(float* out, const float* in) {
-    int ch     = player.channels;
-    int n      = LATENCY * player.samplerate / 1000;
-    float* win = player.window;
+// copy to audio thread memory
+static void* rt_dup(const void* ptr, size_t size) {
+    return memcpy(rt_alloc(size), ptr, size);
+}
 
-    for (int i = 0; i < n * ch; i++) {
-        out[i] = win[i] * out[i] + (1.0f - win[i]) * in[i];
+// lock audio thread memory, later allocations are bugs
+static void rt_seal(void) {
+#ifndef _WIN32
+    for (int i = 0; i < arena.count; i++) {
+        mlock(arena.chunks[i], arena.sizes[i]); // may be denied by rlimit
     }
+#endif
+    arena.sealed = true;
 }
 
-// audio processing callback
-static int process(const void* input, void* output, unsigned long n, const PaStreamCallbackTimeInfo* time, PaStreamCallbackFlags flags, void* data) {
-    int    ch  = player.channels;
-    float* in  = tracks[player.track].pcm + player.pos * ch;
-    float* out = output;
-
-    if (player.paused) {
-        memset(out, 0, n * ch * sizeof(float));
-        return paContinue;
-    }
+#ifdef _WIN32
+struct thread_start {
+    void* (*fn)(void*);
+    void* ctx;
+};
 
-    memcpy(out, in, n * ch * sizeof(float));
+static DWORD WINAPI thread_main(LPVOID ptr) {
+    struct thread_start s = *(struct thread_start*)ptr;
+    free(ptr);
+    s.fn(s.ctx);
+    return 0;
+}
+#endif
 
-    // track switch windowing
-    if (player.track != player.next) {
-        in = tracks[player.next].pcm + player.pos * ch;
-        apply_window(out, in);
-        player.track = player.next;
+// run fn(ctx) on a new thread
+static thread_t spawn(void* (*fn)(void*), void* ctx) {
+#ifdef _WIN32
+    struct thread_start* s = alloc(NULL, sizeof(*s));
+    s->fn  = fn;
+    s->ctx = ctx;
+    HANDLE t = CreateThread(NULL, 0, thread_main, s, 0, NULL);
+    if (!t) {
+        PANIC("thread creation failed\n");
     }
-
-    player.pos += n;
-    // loop windowing
-    if (player.pos > player.end) {
-        in = tracks[player.track].pcm + player.start * ch;
-        apply_window(out, in);
-        player.pos = player.start + n;
+#else
+    pthread_t t;
+    if (pthread_create(&t, NULL, fn, ctx)) {
+        PANIC("thread creation failed\n");
     }
+#endif
+    return t;
+}
 
-    return paContinue;
+static void join(thread_t t) {
+#ifdef _WIN32
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+#else
+    pthread_join(t, NULL);
+#endif
 }
 
-static void init_audio(void) {
-    int err = Pa_Initialize();
-    if (err) {
-        PANIC("audio init failed: %s\n", Pa_GetErrorText(err));
-    }
+static int cpus(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return max((int)info.dwNumberOfProcessors, 1);
+#else
+    return max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+#endif
 }
 
-static void start_stream(void) {
-    int device = Pa_GetDefaultOutputDevice();
-    if (arg.device_index) {
-        device = arg.device_index - 1;
+// run fn on each of count jobs of given size in parallel
+static void run_jobs(void* (*fn)(void*), void* jobs, size_t size, int count) {
+    thread_t* threads = alloc(NULL, count * sizeof(thread_t));
+    for (int i = 0; i < count; i++) {
+        threads[i] = spawn(fn, (char*)jobs + i * size);
     }
-
-    const PaDeviceInfo* info = Pa_GetDeviceInfo(device);
-    if (!info) {
-        PANIC("invalid device index: %d\n", device);
+    for (int i = 0; i < count; i++) {
+        join(threads[i]);
     }
+    free(threads);
+}
 
-    int ch      = player.channels;
-    int sr      = player.samplerate;
-    int samples = LATENCY * sr / 1000;
+// monotonic time in s
+static double now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER f, c;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&c);
+    return (double)c.QuadPart / f.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
 
-    player.end     = player.length;
-    player.running = true;
+static struct cpx cmul(struct cpx a, struct cpx b) {
+    return (struct cpx){a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re};
+}
 
-    PaStreamParameters params = {
-        .device           = device,
-        .channelCount     = ch,
-        .sampleFormat     = paFloat32,
-        .suggestedLatency = info->defaultLowOutputLatency,
-    };
+static struct cpx cadd(struct cpx a, struct cpx b) {
+    return (struct cpx){a.re + b.re, a.im + b.im};
+}
 
-    int err = Pa_OpenStream(&stream, NULL, &params, sr, samples, 0, process, NULL);
-    if (err) {
-        PANIC("stream open failed: %s\n", Pa_GetErrorText(err));
-    }
+static struct cpx csub(struct cpx a, struct cpx b) {
+    return (struct cpx){a.re - b.re, a.im - b.im};
+}
 
-    err = Pa_StartStream(stream);
-    if (err) {
-        PANIC("stream start failed: %s\n", Pa_GetErrorText(err));
-    }
+static struct cpx conj_(struct cpx a) {
+    return (struct cpx){a.re, -a.im};
 }
 
-static void list_devices(void) {
-    int count = Pa_GetDeviceCount();
-    for (int i = 0; i < count; i++) {
-        const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
-        printf("%2d: %s\n", i, info->name);
-    }
+static struct cpx twiddle(double phase) {
+    return (struct cpx){(float)cos(phase), (float)sin(phase)};
 }
 
-// run command and capture stdout
-static struct buffer slurp(const char* command, ...) {
-    char cmd[0x1000] = {0};
-    va_list ap = {0};
+// plan real fft of even size n
+static struct fft* fft_new(int n, bool inverse) {
+    struct fft* f    = alloc(NULL, sizeof(*f));
+    int         m    = n / 2;
+    int         p    = 4;
+    int         i    = 0;
+    int         most = 2;
+    double      sign = inverse ? 1 : -1;
 
-    va_start(ap, command);
-    vsnprintf(cmd, sizeof(cmd) - 1, command, ap);
-    va_end(ap);
-    if (arg.verbose) {
-        printf("%s\n", cmd);
-    }
+    memset(f, 0, sizeof(*f));
+    f->n        = n;
+    f->inverse  = inverse;
+    f->twiddles = alloc(NULL, m * sizeof(struct cpx));
+    f->super    = alloc(NULL, m * sizeof(struct cpx));
+    f->tmp      = alloc(NULL, m * sizeof(struct cpx));
 
-    FILE* f = popen(cmd, "r");
-    if (!f) {
-        PANIC("command failed: %s\n", cmd);
+    for (int k = 0; k < m; k++) {
+        f->twiddles[k] = twiddle(sign * 2 * M_PI * k / m);
+        f->super[k]    = twiddle(sign * M_PI * ((double)(k + 1) / m + 0.5));
     }
 
-    char* buf = NULL;
-    int   len = 0;
-    int   cap = CHUNK_SIZE;
-    int   n   = CHUNK_SIZE;
-
-    while (n == CHUNK_SIZE) {
-        buf = alloc(buf, cap);
-        n   = (int)fread(buf + len, 1, CHUNK_SIZE, f);
-        len += n;
-        cap += CHUNK_SIZE;
+    // radix 4 first, then 2, then odd factors
+    while (m > 1) {
+        while (m % p) {
+            p = p == 4 ? 2 : p == 2 ? 3 : p + 2;
+            if (p * p > m) {
+                p = m;
+            }
+        }
+        m /= p;
+        f->factors[i++] = p;
+        f->factors[i++] = m;
+        most = max(most, p);
     }
-    buf[len] = 0; // ensure zero termination
+    f->scratch = alloc(NULL, most * sizeof(struct cpx));
+    return f;
+}
 
-    if (pclose(f) != 0) {
-        PANIC("command failed: %s\n", cmd);
+static void fft_free(struct fft* f) {
+    if (f) {
+        free(f->twiddles);
+        free(f->super);
+        free(f->tmp);
+        free(f->scratch);
+        free(f);
     }
+}
 
-    return (struct buffer){buf, len};
+// copy of transform in audio thread memory
+static struct fft* fft_rt(int n, bool inverse) {
+    struct fft* f    = fft_new(n, inverse);
+    struct fft* r    = rt_dup(f, sizeof(*f));
+    int         m    = n / 2;
+    int         most = 2;
+    for (int i = 0; f->factors[i]; i += 2) {
+        most = max(most, f->factors[i]);
+    }
+    r->twiddles = rt_dup(f->twiddles, m * sizeof(struct cpx));
+    r->super    = rt_dup(f->super, m * sizeof(struct cpx));
+    r->tmp      = rt_alloc(m * sizeof(struct cpx));
+    r->scratch  = rt_alloc(most * sizeof(struct cpx));
+    fft_free(f);
+    return r;
 }
 
-// search in s for prefix and return subsequent integer
-static int grep_int(const char* s, const char* prefix) {
-    char* tmp  = strstr(s, prefix);
-    if (!tmp) {
-        return 0;
+static void bfly2(struct cpx* out, const struct fft* f, int stride, int m) {
+    for (int k = 0; k < m; k++) {
+        struct cpx t = cmul(out[m + k], f->twiddles[k * stride]);
+        out[m + k] = csub(out[k], t);
+        out[k]     = cadd(out[k], t);
     }
-    return atoi(tmp + strlen(prefix));
 }
 
-// load track from file into ram
-static struct track load_track(char* name) {
-    struct track  t = {0};
-    struct buffer b = {0};
+static void bfly4(struct cpx* out, const struct fft* f, int stride, int m) {
+    for (int k = 0; k < m; k++) {
+        struct cpx s0 = cmul(out[k + m], f->twiddles[k * stride]);
+        struct cpx s1 = cmul(out[k + 2 * m], f->twiddles[2 * k * stride]);
+        struct cpx s2 = cmul(out[k + 3 * m], f->twiddles[3 * k * stride]);
+        struct cpx s5 = csub(out[k], s1);
+        struct cpx a  = cadd(out[k], s1);
+        struct cpx s3 = cadd(s0, s2);
+        struct cpx s4 = csub(s0, s2);
 
-    // get info from ffprobe
-    b = slurp("ffprobe -of flat -show_streams -select_streams a \"%s\"", name);
+        // multiply s4 by -i forward, +i inverse
+        struct cpx r = f->inverse ? (struct cpx){-s4.im, s4.re} : (struct cpx){s4.im, -s4.re};
+        out[k + 2 * m] = csub(a, s3);
+        out[k]         = cadd(a, s3);
+        out[k + m]     = cadd(s5, r);
+        out[k + 3 * m] = csub(s5, r);
+    }
+}
+
+static void bfly_generic(struct cpx* out, const struct fft* f, int stride, int m, int p) {
+    int         n = f->n / 2;
+    struct cpx* s = f->scratch;
+
+    for (int u = 0; u < m; u++) {
+        for (int q = 0; q < p; q++) {
+            s[q] = out[u + q * m];
+        }
+        for (int q = 0; q < p; q++) {
+            int        k   = u + q * m;
+            int        tw  = 0;
+            struct cpx sum = s[0];
+            for (int j = 1; j < p; j++) {
+                tw = (tw + stride * k) % n;
+                sum = cadd(sum, cmul(s[j], f->twiddles[tw]));
+            }
+            out[k] = sum;
+        }
+    }
+}
+
+// recursive decimation in time
+static void fft_work(const struct fft* f, struct cpx* out, const struct cpx* in, int stride, const int* factors) {
+    int p = factors[0];
+    int m = factors[1];
+
+    if (m == 1) {
+        for (int i = 0; i < p; i++) {
+            out[i] = in[i * stride];
+        }
+    } else {
+        for (int i = 0; i < p; i++) {
+            fft_work(f, out + i * m, in + i * stride, stride * p, factors + 2);
+        }
+    }
+
+    if (p == 2) {
+        bfly2(out, f, stride, m);
+    } else if (p == 4) {
+        bfly4(out, f, stride, m);
+    } else {
+        bfly_generic(out, f, stride, m, p);
+    }
+}
+
+// n real samples to n / 2 + 1 bins
+static void fft_real(struct fft* f, const float* in, struct cpx* out) {
+    int m = f->n / 2;
+
+    fft_work(f, f->tmp, (const struct cpx*)in, 1, f->factors);
+
+    struct cpx dc = f->tmp[0];
+    out[0] = (struct cpx){dc.re + dc.im, 0};
+    out[m] = (struct cpx){dc.re - dc.im, 0};
+
+    for (int k = 1; k <= m / 2; k++) {
+        struct cpx a  = f->tmp[k];
+        struct cpx b  = conj_(f->tmp[m - k]);
+        struct cpx e  = cadd(a, b);
+        struct cpx o  = cmul(csub(a, b), f->super[k - 1]);
+        out[k]     = (struct cpx){0.5f * (e.re + o.re), 0.5f * (e.im + o.im)};
+        out[m - k] = (struct cpx){0.5f * (e.re - o.re), 0.5f * (o.im - e.im)};
+    }
+}
+
+// n / 2 + 1 bins to n real samples, scaled by n
+static void fft_real_inverse(struct fft* f, const struct cpx* in, float* out) {
+    int m = f->n / 2;
+
+    f->tmp[0] = (struct cpx){in[0].re + in[m].re, in[0].re - in[m].re};
+    for (int k = 1; k <= m / 2; k++) {
+        struct cpx a = in[k];
+        struct cpx b = conj_(in[m - k]);
+        struct cpx e = cadd(a, b);
+        struct cpx o = cmul(csub(a, b), f->super[k - 1]);
+        f->tmp[k]     = cadd(e, o);
+        f->tmp[m - k] = conj_(csub(e, o));
+    }
+
+    fft_work(f, (struct cpx*)out, f->tmp, 1, f->factors);
+}
+
+// generate cross-fade window
+static void gen_window(void) {
+    int ch     = player.channels;
+    int n      = LATENCY * player.samplerate / 1000;
+    float* win = rt_alloc(n * ch * sizeof(float));
+
+    for (int i = 0; i < n; i++) {
+        double w = 0.5 + 0.5 * cos(M_PI * i / n);
+        for (int c = 0; c < ch; c++) {
+            win[i * ch + c] = (float)w;
+        }
+    }
+    player.window = win;
+    player.span   = rt_alloc(n * ch * sizeof(float));
+}
+
+// cross-fade out to in using window
+static void apply_window(float* out, const float* in) {
+    int ch     = player.channels;
+    int n      = LATENCY * player.samplerate / 1000;
+    float* win = player.window;
+
+    for (int i = 0; i < n * ch; i++) {
+        out[i] = win[i] * out[i] + (1.0f - win[i]) * in[i];
+    }
+}
+
+// y += x * h on split complex spectra of n bins, n multiple of 4
+static void conv_mac(float* y, const float* x, const float* h, int n) {
+    int i = 0;
+#ifdef __SSE2__
+    for (; i < n; i += 4) {
+        __m128 xr = _mm_loadu_ps(x + i);
+        __m128 xi = _mm_loadu_ps(x + n + i);
+        __m128 hr = _mm_loadu_ps(h + i);
+        __m128 hi = _mm_loadu_ps(h + n + i);
+        __m128 yr = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+        __m128 yi = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), yr));
+        _mm_storeu_ps(y + n + i, _mm_add_ps(_mm_loadu_ps(y + n + i), yi));
+    }
+#endif
+    for (; i < n; i++) {
+        y[i]     += x[i] * h[i] - x[n + i] * h[n + i];
+        y[n + i] += x[i] * h[n + i] + x[n + i] * h[i];
+    }
+}
+
+// sum of filter partitions from..to - 1 times matching input spectra of block for output o
+static void conv_sum(struct conv* cv, float* y, int o, int block, int from, int to) {
+    int b     = cv->bins;
+    int first = cv->matrix ? 0 : o;
+    int last  = cv->matrix ? cv->inputs : o + 1;
+
+    for (int i = first; i < last; i++) {
+        int    f = cv->matrix ? i * cv->outputs + o : o % cv->filters;
+        float* h = cv->h + (size_t)f * cv->parts * 2 * b;
+        float* x = cv->x + (size_t)i * cv->slots * 2 * b;
+        for (int p = from; p < to; p++) {
+            int s = ((block - p) % cv->slots + cv->slots) % cv->slots;
+            conv_mac(y, x + (size_t)s * 2 * b, h + (size_t)p * 2 * b, b);
+        }
+    }
+}
+
+static float* conv_tail_sum(struct conv* cv, int block, int o) {
+    return cv->tail + ((size_t)(block % (CONV_HEAD + 1)) * cv->outputs + o) * 2 * cv->bins;
+}
+
+static float* conv_tail_lo(struct conv* cv, int block, int o) {
+    return cv->lo + ((size_t)(block % (CONV_HEAD + 1)) * cv->outputs + o) * 2 * cv->bins;
+}
+
+// partitions convolved at quality q
+static int conv_cut(struct conv* cv, int q) {
+    return max(q >= 2 ? cv->parts : q == 1 ? CONV_HEAD + (cv->parts - CONV_HEAD) / 2 : CONV_HEAD, CONV_HEAD);
+}
+
+// tail sum of block for output o at quality q, NULL if it was not kept
+static float* conv_tail_at(struct conv* cv, int block, int o, int q) {
+    int s = block % (CONV_HEAD + 1);
+    if (conv_cut(cv, q) == cv->tail_hi[s]) {
+        return conv_tail_sum(cv, block, o);
+    }
+    if (conv_cut(cv, q) == cv->tail_lo[s]) {
+        return conv_tail_lo(cv, block, o);
+    }
+    return NULL;
+}
+
+// tail partitions only need input spectra up to block - CONV_HEAD
+// on a quality change the sum is kept at both cuts, so the callback can crossfade
+static void conv_tail(struct conv* cv, int block) {
+    int s    = block % (CONV_HEAD + 1);
+    int q    = atomic_load_explicit(&cv->quality, memory_order_relaxed);
+    int prev = atomic_exchange_explicit(&cv->computed, q, memory_order_relaxed);
+    int lo   = min(conv_cut(cv, q), conv_cut(cv, prev));
+    int hi   = max(conv_cut(cv, q), conv_cut(cv, prev));
+
+    cv->tail_q[s]  = q;
+    cv->tail_lo[s] = lo;
+    cv->tail_hi[s] = hi;
+    for (int o = 0; o < cv->outputs; o++) {
+        float* y = conv_tail_sum(cv, block, o);
+        memset(y, 0, 2 * cv->bins * sizeof(float));
+        conv_sum(cv, y, o, block, CONV_HEAD, lo);
+        if (lo < hi) {
+            memcpy(conv_tail_lo(cv, block, o), y, 2 * cv->bins * sizeof(float));
+            conv_sum(cv, y, o, block, lo, hi);
+        }
+    }
+}
+
+// tail worker, runs up to CONV_HEAD blocks ahead of the callback
+static void* conv_main(void* ptr) {
+    struct conv* cv = ptr;
+    RT_ENTER();
+    for (;;) {
+        int last = atomic_load(&cv->claimed);
+        int next = last + 1;
+        if (next - CONV_HEAD <= atomic_load_explicit(&cv->avail, memory_order_acquire) &&
+            atomic_compare_exchange_strong(&cv->claimed, &last, next)) {
+            conv_tail(cv, next);
+            atomic_store_explicit(&cv->done, next, memory_order_release);
+        } else {
+            Pa_Sleep(1);
+        }
+    }
+    return NULL;
+}
+
+// one output buffer at quality q, dry if bypassed, the tail left out if late
+static void conv_output(struct conv* cv, const float* src, float* dst, int q, bool late) {
+    int m = cv->size;
+    int b = cv->bins;
+    int k = cv->block;
+
+    if (q < 0) {
+        for (int i = 0; i < m; i++) {
+            for (int o = 0; o < cv->outputs; o++) {
+                dst[i * cv->outputs + o] = src[i * cv->inputs + o % cv->inputs];
+            }
+        }
+        return;
+    }
+    for (int o = 0; o < cv->outputs; o++) {
+        float* tail = late ? NULL : conv_tail_at(cv, k, o, q);
+        if (tail) {
+            memcpy(cv->acc, tail, 2 * b * sizeof(float));
+        } else {
+            memset(cv->acc, 0, 2 * b * sizeof(float));
+        }
+        conv_sum(cv, cv->acc, o, k, 0, min(CONV_HEAD, cv->parts));
+        for (int i = 0; i <= m; i++) {
+            cv->spec[i] = (struct cpx){cv->acc[i], cv->acc[b + i]};
+        }
+        fft_real_inverse(cv->inv, cv->spec, cv->buf);
+        for (int i = 0; i < m; i++) {
+            dst[i * cv->outputs + o] = cv->buf[m + i];
+        }
+    }
+}
+
+// convolve one buffer of interleaved frames, src and dst may be the same, true if the tail was late
+// input spectra are kept up to date while bypassed, so the filter comes back without stale history
+static bool conv_process(struct conv* cv, const float* src, float* dst, int n) {
+    int m     = cv->size;
+    int b     = cv->bins;
+    int k     = cv->block;
+    bool late = false;
+
+    if (!cv->parts || n != m) {
+        return false;
+    }
+
+    // one forward transform per input, shared by all outputs
+    for (int c = 0; c < cv->inputs; c++) {
+        float* in = cv->in + (size_t)c * 2 * m;
+        float* x  = cv->x + ((size_t)c * cv->slots + k % cv->slots) * 2 * b;
+        memmove(in, in + m, m * sizeof(float));
+        for (int i = 0; i < m; i++) {
+            in[m + i] = src[i * cv->inputs + c];
+        }
+        fft_real(cv->fwd, in, cv->spec);
+        for (int i = 0; i <= m; i++) {
+            x[i]     = cv->spec[i].re;
+            x[b + i] = cv->spec[i].im;
+        }
+    }
+    atomic_store_explicit(&cv->avail, k, memory_order_release);
+
+    // take over the tail if the worker has not started it, else wait a bounded time for it
+    int last = k - 1;
+    if (atomic_compare_exchange_strong(&cv->claimed, &last, k)) {
+        conv_tail(cv, k);
+    } else {
+        double until = now() + CONV_WAIT * m / player.samplerate;
+        while (!late && atomic_load_explicit(&cv->done, memory_order_acquire) < k) {
+            late = now() > until;
+        }
+    }
+
+    // a late tail is dropped for this block, the worker still owns its slot
+    int q    = late ? cv->played : cv->tail_q[k % (CONV_HEAD + 1)];
+    int prev = cv->played;
+    if (q != prev && (prev < 0 || conv_tail_at(cv, k, 0, prev))) {
+        // crossfade over one buffer from the previous quality
+        conv_output(cv, src, cv->fade, prev, false);
+        conv_output(cv, src, dst, q, false);
+        for (int i = 0; i < m; i++) {
+            for (int o = 0; o < cv->outputs; o++) {
+                float* y = dst + i * cv->outputs + o;
+                *y       = cv->win[i] * cv->fade[i * cv->outputs + o] + (1.0f - cv->win[i]) * *y;
+            }
+        }
+    } else {
+        conv_output(cv, src, dst, q, late);
+    }
+    cv->played = q;
+    cv->block  = k + 1;
+    if (late) {
+        atomic_fetch_add_explicit(&stats.late, 1, memory_order_relaxed);
+    }
+    return late;
+}
+
+// shed is pointless if its stage is not active or has no tail to cut
+static bool shed_noop(const struct shed* s) {
+    return !s->cv->parts || (s->quality >= 0 && s->cv->parts <= CONV_HEAD + 1);
+}
+
+static void govern_apply(int level) {
+    int cq = 2;
+    int bq = 2;
+    for (int i = 0; i < level; i++) {
+        cq = sheds[i].cv == &correction ? sheds[i].quality : cq;
+        bq = sheds[i].cv == &binaural ? sheds[i].quality : bq;
+    }
+    atomic_store_explicit(&correction.quality, cq, memory_order_relaxed);
+    atomic_store_explicit(&binaural.quality, bq, memory_order_relaxed);
+    atomic_store_explicit(&governor.level, level, memory_order_relaxed);
+}
+
+// shed optional stages when the callback gets close to its deadline, restore them with headroom
+static void govern(int load, bool underflow) {
+    int level = atomic_load_explicit(&governor.level, memory_order_relaxed);
+    int next  = level;
+
+    governor.hold -= governor.hold > 0;
+    governor.calm  = load < GOV_LOW ? governor.calm + 1 : 0;
+
+    if ((load > GOV_HIGH || underflow) && !governor.hold) {
+        while (next < SHEDS && shed_noop(&sheds[next])) {
+            next += 1;
+        }
+        next = next < SHEDS ? next + 1 : level;
+    } else if (governor.calm >= GOV_CALM && level > 0) {
+        next -= 1;
+        while (next > 0 && shed_noop(&sheds[next - 1])) {
+            next -= 1;
+        }
+    }
+    if (next != level) {
+        govern_apply(next);
+        governor.hold = GOV_HOLD;
+        governor.calm = 0;
+    }
+}
+
+// read n bits at bit position
+static uint64_t get_bits(const uint64_t* w, size_t pos, int n) {
+    size_t   i = pos >> 6;
+    int      o = pos & 63;
+    uint64_t x = w[i] >> o;
+    if (o + n > 64) {
+        x |= w[i + 1] << (64 - o);
+    }
+    return n < 64 ? x & (((uint64_t)1 << n) - 1) : x;
+}
+
+static int trailing_ones(uint64_t x) {
+#ifdef __GNUC__
+    return ~x ? __builtin_ctzll(~x) : 64;
+#else
+    int n = 0;
+    for (; n < 64 && (x >> n & 1); n++) {
+    }
+    return n;
+#endif
+}
+
+// decode frames [from, to) of block b as residual into dst
+static void delta_block(const struct delta* d, int ch, int b, int from, int to, float* dst) {
+    size_t pos = d->offset[b];
+    int    k   = d->param[b];
+    int    lo  = (from - b * DELTA_BLOCK) * ch;
+    int    hi  = (to - b * DELTA_BLOCK) * ch;
+
+    // one 64 bit read per value, a coded value is at most 56 bits
+    for (int i = 0; i < hi; i++) {
+        uint64_t x = get_bits(d->bits, pos, 64);
+        int      q = min(trailing_ones(x), DELTA_ESC);
+        uint32_t u;
+        if (q == DELTA_ESC) {
+            u = (uint32_t)(x >> DELTA_ESC);
+            pos += DELTA_ESC + 32;
+        } else {
+            u = (uint32_t)q << k | (uint32_t)((x >> (q + 1)) & (((uint64_t)1 << k) - 1));
+            pos += q + 1 + k;
+        }
+        if (i >= lo) {
+            int32_t v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+            dst[i - lo] = v / DELTA_SCALE;
+        }
+    }
+}
+
+// y += x
+static void add_frames(float* y, const float* x, int n) {
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_loadu_ps(x + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        y[i] += x[i];
+    }
+}
+
+// n frames from pos, pointer into a block if the span doesn't cross a block boundary
+static const float* block_span(const struct blocks* k, int ch, int pos, int n, float* buf) {
+    int b = pos / DEDUP_BLOCK;
+    int o = pos % DEDUP_BLOCK;
+    if (o + n <= DEDUP_BLOCK) {
+        return k->data[b] + (size_t)o * ch;
+    }
+    for (int p = pos; p < pos + n; b++, o = 0) {
+        int m = min(DEDUP_BLOCK - o, pos + n - p);
+        memcpy(buf + (size_t)(p - pos) * ch, k->data[b] + (size_t)o * ch, (size_t)m * ch * sizeof(float));
+        p += m;
+    }
+    return buf;
+}
+
+// interleave n frames of channel planes from pos into dst
+static void interleave(const struct planes* k, int ch, int pos, int n, float* dst) {
+    const float* x = k->data + pos;
+    if (ch == 2) {
+        const float* y = x + k->stride;
+        int          i = 0;
+#ifdef __SSE2__
+        for (; i + 4 <= n; i += 4) {
+            __m128 l = _mm_loadu_ps(x + i);
+            __m128 r = _mm_loadu_ps(y + i);
+            _mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(l, r));
+        }
+#endif
+        for (; i < n; i++) {
+            dst[2 * i]     = x[i];
+            dst[2 * i + 1] = y[i];
+        }
+        return;
+    }
+    for (int c = 0; c < ch; c++, x += k->stride) {
+        for (int i = 0; i < n; i++) {
+            dst[i * ch + c] = x[i];
+        }
+    }
+}
+
+// n frames of track from pos, pointer into the track or decoded into buf, safe on any thread
+static const float* track_span(const struct track* t, int pos, int n, float* buf) {
+    const struct delta* d  = &t->delta;
+    int                 ch = t->channels;
+    if (t->blocks.data) {
+        return block_span(&t->blocks, ch, pos, n, buf);
+    }
+    if (t->planes.data) {
+        interleave(&t->planes, ch, pos, n, buf);
+        return buf;
+    }
+    if (!d->ref) {
+        return t->pcm + (size_t)pos * ch;
+    }
+
+    // decode residual block by block, then add the reference
+    for (int p = pos; p < pos + n;) {
+        int b  = p / DELTA_BLOCK;
+        int to = min(min((b + 1) * DELTA_BLOCK, pos + n), d->frames);
+        if (to <= p) {
+            memset(buf + (size_t)(p - pos) * ch, 0, (size_t)(pos + n - p) * ch * sizeof(float));
+            break;
+        }
+        delta_block(d, ch, b, p, to, buf + (size_t)(p - pos) * ch);
+        p = to;
+    }
+    int m = max(min(pos + n, d->ref_frames) - pos, 0);
+    if (m) {
+        add_frames(buf, d->ref->pcm + (size_t)pos * ch, m * ch); // references are never coded
+    }
+    return buf;
+}
+
+// copy n frames of track from pos to dst
+static void track_read(const struct track* t, int pos, int n, float* dst) {
+    const float* x = track_span(t, pos, n, dst);
+    if (x != dst) {
+        memcpy(dst, x, (size_t)n * t->channels * sizeof(float));
+    }
+}
+
+// queue event, dropped if the queue is full
+static void post_event(struct event e) {
+    unsigned t = atomic_load_explicit(&events.tail, memory_order_relaxed);
+    if (t - atomic_load_explicit(&events.head, memory_order_acquire) < EVENTS) {
+        events.queue[t % EVENTS] = e;
+        atomic_store_explicit(&events.tail, t + 1, memory_order_release);
+    }
+}
+
+// next event due, switches at the loop seam are due only there
+static int take_event(const struct table* tab, bool seam) {
+    unsigned h = atomic_load_explicit(&events.head, memory_order_relaxed);
+    if (h == atomic_load_explicit(&events.tail, memory_order_acquire)) {
+        return -1;
+    }
+    struct event e = events.queue[h % EVENTS];
+    if (e.wrap && !seam) {
+        return -1;
+    }
+    atomic_store_explicit(&events.head, h + 1, memory_order_release);
+    return tab->tracks[e.track] ? e.track : -1;
+}
+
+// audio processing callback
+static int process(const void* input, void* output, unsigned long n, const PaStreamCallbackTimeInfo* time, PaStreamCallbackFlags flags, void* data) {
+    RT_ENTER();
+    struct table* tab = atomic_load_explicit(&table, memory_order_acquire);
+    struct track** tracks = tab->tracks;
+    double         begin  = now();
+
+    int          ch  = player.channels;
+    float*       out = binaural.parts ? player.mix : output;
+    const float* in  = NULL;
+    int          e   = -1;
+
+    if (atomic_load_explicit(&events.flush, memory_order_acquire)) {
+        atomic_store_explicit(&events.head, atomic_load_explicit(&events.tail, memory_order_acquire),
+                              memory_order_release);
+        atomic_store_explicit(&events.flush, false, memory_order_release);
+    }
+
+    if (player.paused) {
+        memset(out, 0, n * ch * sizeof(float));
+        conv_process(&binaural, out, output, n); // let the filters ring out
+        conv_process(&correction, output, output, n);
+        atomic_fetch_add_explicit(&epoch, 1, memory_order_release);
+        RT_LEAVE();
+        return paContinue;
+    }
+
+    if ((e = take_event(tab, false)) >= 0) {
+        player.next = e;
+    }
+    in = track_span(tracks[player.track], player.pos, n, out);
+    if (in != out) {
+        memcpy(out, in, n * ch * sizeof(float));
+    }
+
+    // track switch windowing
+    if (player.track != player.next) {
+        in = track_span(tracks[player.next], player.pos, n, player.span);
+        apply_window(out, in);
+        player.track = player.next;
+    }
+
+    player.pos += n;
+    // seek windowing
+    if (player.seek >= 0) {
+        in = track_span(tracks[player.track], player.seek, n, player.span);
+        apply_window(out, in);
+        player.pos  = player.seek + n;
+        player.seek = -1;
+    }
+    // loop windowing, aligned so that end continues exactly at start, scheduled switch happens at the seam
+    // if the end was moved below the position, jump to start
+    if (player.pos > player.end) {
+        int prev = player.pos - (int)n;
+        int from = prev <= player.end ? max(player.start - (player.end - prev), 0) : player.start;
+        if ((e = take_event(tab, true)) >= 0) {
+            player.track = player.next = e;
+        }
+        in = track_span(tracks[player.track], from, n, player.span);
+        apply_window(out, in);
+        player.pos = from + n;
+    }
+    bool late = conv_process(&binaural, out, output, n);
+    late |= conv_process(&correction, output, output, n);
+
+    // callback load in % of buffer duration
+    int load = (int)((now() - begin) * player.samplerate * 100 / n);
+    atomic_fetch_add_explicit(&stats.load_hist[min(load, LOAD_BINS - 1)], 1, memory_order_relaxed);
+    if (flags & paOutputUnderflow) {
+        atomic_fetch_add_explicit(&stats.underruns, 1, memory_order_relaxed);
+    }
+    govern(load, (flags & paOutputUnderflow) || late);
+
+    // tracks retired before this point are no longer referenced
+    atomic_fetch_add_explicit(&epoch, 1, memory_order_release);
+    RT_LEAVE();
+    return paContinue;
+}
+
+static void init_audio(void) {
+    int err = Pa_Initialize();
+    if (err) {
+        PANIC("audio init failed: %s\n", Pa_GetErrorText(err));
+    }
+}
+
+static void open_stream(void) {
+    int device = Pa_GetDefaultOutputDevice();
+    if (arg.device_index) {
+        device = arg.device_index - 1;
+    }
+
+    const PaDeviceInfo* info = Pa_GetDeviceInfo(device);
+    if (!info) {
+        PANIC("invalid device index: %d\n", device);
+    }
+
+    // format is published by the loader
+    while (!atomic_load(&audio.outputs)) {
+        Pa_Sleep(1);
+    }
+    double s       = now();
+    int    ch      = atomic_load(&audio.outputs);
+    int    sr      = atomic_load(&audio.samplerate);
+    int    samples = LATENCY * sr / 1000;
+
+    PaStreamParameters params = {
+        .device           = device,
+        .channelCount     = ch,
+        .sampleFormat     = paFloat32,
+        .suggestedLatency = info->defaultLowOutputLatency,
+    };
+
+    int err = Pa_OpenStream(&stream, NULL, &params, sr, samples, 0, process, NULL);
+    if (err) {
+        PANIC("stream open failed: %s\n", Pa_GetErrorText(err));
+    }
+    stats.open = now() - s;
+}
+
+// init backend, look up device and open stream, overlapped with decoding
+static void* audio_main(void* ptr) {
+    double s = now();
+    init_audio();
+    stats.init = now() - s;
+    open_stream();
+    return NULL;
+}
+
+// publish stream format of first track, audio setup waits for it
+static void publish_format(const struct track* t) {
+    atomic_store(&audio.samplerate, arg.device_rate ? arg.device_rate : t->samplerate);
+    atomic_store(&audio.outputs, arg.hrir ? 2 : t->channels); // headphone rendering is stereo
+}
+
+static void start_stream(void) {
+    player.end     = player.length;
+    player.seek    = -1;
+    player.running = true;
+    rt_seal();
+
+    int err = Pa_StartStream(stream);
+    if (err) {
+        PANIC("stream start failed: %s\n", Pa_GetErrorText(err));
+    }
+}
+
+static void list_devices(void) {
+    int count = Pa_GetDeviceCount();
+    for (int i = 0; i < count; i++) {
+        const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
+        printf("%2d: %s\n", i, info->name);
+    }
+}
+
+// start command with readable stdout, NULL if it fails
+static FILE* command_open(const char* cmd) {
+    if (arg.verbose) {
+        printf("%s\n", cmd);
+    }
+    FILE* f = popen(cmd, "r");
+    if (!f) {
+        printf("command failed: %s\n", cmd);
+    }
+    return f;
+}
+
+// read rest of command output, chunk callback sees data as it arrives, buf is NULL if the command fails
+static struct buffer command_read(FILE* f, const char* cmd, void (*chunk)(void*, const char*, int), void* ctx) {
+    char* buf = NULL;
+    int   len = 0;
+    int   cap = CHUNK_SIZE;
+    int   n   = CHUNK_SIZE;
+
+    while (n == CHUNK_SIZE) {
+        buf = alloc(buf, cap);
+        n   = (int)fread(buf + len, 1, CHUNK_SIZE, f);
+        len += n;
+        cap += CHUNK_SIZE;
+        if (chunk) {
+            chunk(ctx, buf, len);
+        }
+    }
+    buf[len] = 0; // ensure zero termination
+
+    if (pclose(f) != 0) {
+        printf("command failed: %s\n", cmd);
+        free(buf);
+        return (struct buffer){0};
+    }
+
+    return (struct buffer){buf, len};
+}
+
+// run command and capture stdout, chunk callback sees data as it arrives, buf is NULL if the command fails
+static struct buffer slurp(void (*chunk)(void*, const char*, int), void* ctx, const char* command, ...) {
+    char cmd[0x1000] = {0};
+    va_list ap = {0};
+
+    va_start(ap, command);
+    vsnprintf(cmd, sizeof(cmd) - 1, command, ap);
+    va_end(ap);
+
+    FILE* f = command_open(cmd);
+    return f ? command_read(f, cmd, chunk, ctx) : (struct buffer){0};
+}
+
+// search in s for prefix and return subsequent integer
+static int grep_int(const char* s, const char* prefix) {
+    char* tmp  = strstr(s, prefix);
+    if (!tmp) {
+        return 0;
+    }
+    return atoi(tmp + strlen(prefix));
+}
+
+// slot of block x, compared by content if size is given, or empty slot to insert it
+static int pool_slot(uint64_t hash, const float* x, size_t size) {
+    int i = (int)(hash & (pool.size - 1));
+    for (;; i = (i + 1) & (pool.size - 1)) {
+        struct pool_entry* e = &pool.slots[i];
+        if (!e->hash && !e->data) {
+            return i;
+        }
+        if (e->data && e->hash == hash && (e->data == x || (size && !memcmp(e->data, x, size)))) {
+            return i;
+        }
+    }
+}
+
+// grow table and drop removed entries
+static void pool_rehash(void) {
+    struct pool_entry* old  = pool.slots;
+    int                size = pool.size;
+
+    pool.size  = max(pool.size * 2, 1024);
+    pool.slots = alloc(NULL, pool.size * sizeof(*pool.slots));
+    pool.used  = 0;
+    memset(pool.slots, 0, pool.size * sizeof(*pool.slots));
+    for (int i = 0; i < size; i++) {
+        if (old[i].data) {
+            pool.slots[pool_slot(old[i].hash, NULL, 0)] = old[i];
+            pool.used += 1;
+        }
+    }
+    free(old);
+}
+
+// unreference blocks, blocks no track uses anymore are freed
+static void release_blocks(struct blocks* k) {
+    for (int b = 0; b < k->count; b++) {
+        struct pool_entry* e = &pool.slots[pool_slot(k->hash[b], k->data[b], 0)];
+        if (--e->refs == 0) {
+            free(e->data);
+            e->data = NULL; // hash stays set, probe sequences continue past it
+        }
+    }
+    free(k->data);
+    free(k->hash);
+    *k = (struct blocks){0};
+}
+
+// release pcm buffer or cache mapping
+static void free_pcm(struct track* t) {
+#ifndef _WIN32
+    if (t->storage == STORAGE_CACHE) {
+        munmap(t->pcm, t->mapped);
+        close(t->fd);
+        t->pcm = NULL;
+        return;
+    }
+#endif
+    free(t->pcm);
+    t->pcm = NULL;
+}
+
+static void free_track(struct track* t) {
+    free(t->delta.bits);
+    free(t->delta.offset);
+    free(t->delta.param);
+    t->delta = (struct delta){0};
+    release_blocks(&t->blocks);
+#ifndef _WIN32
+    if (t->shared.base) {
+        // moved buffers live in the mapping
+        t->pcm        = t->pcm == t->shared.base ? NULL : t->pcm;
+        t->planes.buf = t->planes.buf == t->shared.base ? NULL : t->planes.buf;
+        munmap(t->shared.base, t->shared.size);
+        shm_unlink(t->shared.name);
+        t->shared = (struct shared){0};
+    }
+#endif
+    free(t->planes.buf);
+    t->planes = (struct planes){0};
+    free_pcm(t);
+}
+
+// block maximum, clip count and channel sums of interleaved samples
+static float scan_block(const float* x, int frames, int ch, double* sum, int* clips) {
+    int   n    = frames * ch;
+    int   i    = 0;
+    float peak = 0;
+
+#ifdef __SSE2__
+    // vectors of 4 * ch samples, lane j of vector k belongs to channel (4 * k + j) % ch
+    __m128  one  = _mm_set1_ps(1.0f);
+    __m128  sign = _mm_set1_ps(-0.0f);
+    __m128  vmax = _mm_setzero_ps();
+    __m128i vclp = _mm_setzero_si128();
+    __m128  acc[64];
+    if (ch <= 64) {
+        for (int k = 0; k < ch; k++) {
+            acc[k] = _mm_setzero_ps();
+        }
+        for (; i + 4 * ch <= n; i += 4 * ch) {
+            for (int k = 0; k < ch; k++) {
+                __m128 v = _mm_loadu_ps(x + i + 4 * k);
+                __m128 a = _mm_andnot_ps(sign, v);
+                acc[k] = _mm_add_ps(acc[k], v);
+                vmax   = _mm_max_ps(vmax, a);
+                vclp   = _mm_sub_epi32(vclp, _mm_castps_si128(_mm_cmpge_ps(a, one)));
+            }
+        }
+        float lanes[4];
+        int   count[4];
+        for (int k = 0; k < ch; k++) {
+            _mm_storeu_ps(lanes, acc[k]);
+            for (int j = 0; j < 4; j++) {
+                sum[(4 * k + j) % ch] += lanes[j];
+            }
+        }
+        _mm_storeu_ps(lanes, vmax);
+        _mm_storeu_si128((__m128i*)count, vclp);
+        for (int j = 0; j < 4; j++) {
+            peak = fmaxf(peak, lanes[j]);
+            *clips += count[j];
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        float a = fabsf(x[i]);
+        sum[i % ch] += x[i];
+        peak = fmaxf(peak, a);
+        *clips += a >= 1.0f;
+    }
+    return peak;
+}
+
+// oversampled peak of frames [from, to), reads TP_TAPS / 2 frames around
+static float interpolate_peak(const float* pcm, int ch, int from, int to, const float* taps) {
+    float peak = 0;
+
+    // interleaved channels form one stream with taps ch samples apart
+    for (int p = 1; p < TP_PHASES; p++) {
+        const float* h = taps + p * TP_TAPS;
+        const float* x = pcm - (TP_TAPS / 2 - 1) * ch;
+        int          m = from * ch;
+
+#ifdef __SSE2__
+        __m128 sign = _mm_set1_ps(-0.0f);
+        __m128 vmax = _mm_setzero_ps();
+        float  lanes[4];
+        for (; m + 4 <= to * ch; m += 4) {
+            __m128 y = _mm_setzero_ps();
+            for (int k = 0; k < TP_TAPS; k++) {
+                y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(h[k]), _mm_loadu_ps(x + m + k * ch)));
+            }
+            vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, y));
+        }
+        _mm_storeu_ps(lanes, vmax);
+        for (int j = 0; j < 4; j++) {
+            peak = fmaxf(peak, lanes[j]);
+        }
+#endif
+
+        for (; m < to * ch; m++) {
+            float y = 0;
+            for (int k = 0; k < TP_TAPS; k++) {
+                y += h[k] * x[m + k * ch];
+            }
+            peak = fmaxf(peak, fabsf(y));
+        }
+    }
+    return peak;
+}
+
+// start level scan of track with given channel count
+static void scan_init(struct scanner* s, struct scan* r, int ch) {
+    memset(s, 0, sizeof(*s));
+    memset(r, 0, sizeof(*r));
+    s->r     = r;
+    s->ch    = ch;
+    s->sum   = alloc(NULL, ch * sizeof(double));
+    r->first = -1;
+    memset(s->sum, 0, ch * sizeof(double));
+
+    // interpolation filter, phase 0 is the sample itself
+    for (int p = 0; p < TP_PHASES; p++) {
+        float g = 0;
+        for (int k = 0; k < TP_TAPS; k++) {
+            double x = k - TP_TAPS / 2 + 1 - (double)p / TP_PHASES;
+            double w = 0.5 + 0.5 * cos(M_PI * x / (TP_TAPS / 2));
+            s->taps[p * TP_TAPS + k] = (float)(x == 0 ? 1 : w * sin(M_PI * x) / (M_PI * x));
+            g += fabsf(s->taps[p * TP_TAPS + k]);
+        }
+        s->gain = fmaxf(s->gain, g);
+    }
+}
+
+// scan decoded frames, called while the decoder still writes the buffer
+static void scan_update(struct scanner* s, const float* pcm, int frames, bool final) {
+    struct scan* r     = s->r;
+    int          ch    = s->ch;
+    int          avail = final ? frames : frames - TP_TAPS;
+    double       begin = now();
+
+    while (s->done < avail && (final || s->done + SCAN_BLOCK <= avail)) {
+        int          from = s->done;
+        int          to   = min(from + SCAN_BLOCK, avail);
+        const float* x    = pcm + from * ch;
+        float        peak = scan_block(x, to - from, ch, s->sum, &r->clips);
+
+        r->peak = fmaxf(r->peak, peak);
+        if (peak >= SILENCE) {
+            int i = (to - from) * ch - 1;
+            while (fabsf(x[i]) < SILENCE) {
+                i--;
+            }
+            r->last = from + i / ch;
+            for (i = 0; r->first < 0; i++) {
+                r->first = fabsf(x[i]) < SILENCE ? -1 : from + i / ch;
+            }
+        }
+
+        // only blocks that can exceed the current true peak are oversampled
+        if (peak * s->gain > r->true_peak) {
+            int lo = max(from, TP_TAPS / 2);
+            int hi = min(to, frames - TP_TAPS / 2);
+            r->true_peak = fmaxf(r->true_peak, fmaxf(peak, interpolate_peak(pcm, ch, lo, hi, s->taps)));
+        }
+        s->done = to;
+    }
+    s->time += now() - begin;
+}
+
+// finish scan, frames is the final track length
+static void scan_done(struct scanner* s, int frames) {
+    struct scan* r = s->r;
+
+    for (int c = 0; c < s->ch && frames; c++) {
+        double dc = s->sum[c] / frames;
+        if (fabs(dc) > fabs(r->dc)) {
+            r->dc         = dc;
+            r->dc_channel = c;
+        }
+    }
+    if (r->first < 0) {
+        r->first = frames;
+    }
+    free(s->sum);
+}
+
+#define P1 0x9e3779b185ebca87
+#define P2 0xc2b2ae3d27d4eb4f
+#define P3 0x165667b19e3779f9
+#define P4 0x85ebca77c2b2ae63
+#define P5 0x27d4eb2f165667c5
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t x) {
+    return rotl(acc + x * P2, 31) * P1;
+}
+
+static uint64_t xxh_merge(uint64_t h, uint64_t acc) {
+    return (h ^ xxh_round(0, acc)) * P1 + P4;
+}
+
+static uint64_t read64(const unsigned char* p) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    return x;
+}
+
+// 64 bit xxHash, XXH64 with native byte order
+static uint64_t xxh64(uint64_t seed, const void* data, size_t size) {
+    const unsigned char* p   = data;
+    const unsigned char* end = p + size;
+    uint64_t             h;
+
+    if (size >= 32) {
+        uint64_t v[4] = {seed + P1 + P2, seed + P2, seed, seed - P1};
+        for (; p + 32 <= end; p += 32) {
+            for (int i = 0; i < 4; i++) {
+                v[i] = xxh_round(v[i], read64(p + i * 8));
+            }
+        }
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = xxh_merge(h, v[i]);
+        }
+    } else {
+        h = seed + P5;
+    }
+    h += size;
+
+    for (; p + 8 <= end; p += 8) {
+        h = rotl(h ^ xxh_round(0, read64(p)), 27) * P1 + P4;
+    }
+    for (; p + 4 <= end; p += 4) {
+        uint32_t x;
+        memcpy(&x, p, 4);
+        h = rotl(h ^ (x * P1), 23) * P2 + P3;
+    }
+    for (; p < end; p++) {
+        h = rotl(h ^ (*p * P5), 11) * P1;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    return h ^ (h >> 32);
+}
+
+// tree hash, leaves of HASH_CHUNK bytes are hashed in parallel as the decoder delivers them
+struct hasher {
+    uint64_t* leaves; // leaf hashes
+    int       count;  // leaves done
+    size_t    done;   // bytes hashed
+    double    time;   // time spent hashing in s
+};
+
+struct hash_job {
+    const char* data;
+    size_t      size;
+    uint64_t    hash;
+};
+
+static void* hash_main(void* ptr) {
+    struct hash_job* job = ptr;
+    job->hash = xxh64(0, job->data, job->size);
+    return NULL;
+}
+
+// hash complete leaves of buffer, all remaining bytes if final
+static void hash_update(struct hasher* h, const char* buf, size_t len, bool final) {
+    int    batch = cpus();
+    size_t ready = final ? len - h->done : (len - h->done) / HASH_CHUNK * HASH_CHUNK;
+    int    n     = (int)((ready + HASH_CHUNK - 1) / HASH_CHUNK);
+
+    // wait for a full batch, spawning threads for single leaves costs more than it saves
+    if (n == 0 || (!final && n < batch)) {
+        return;
+    }
+    double           begin = now();
+    struct hash_job* jobs  = alloc(NULL, n * sizeof(*jobs));
+    for (int i = 0; i < n; i++) {
+        size_t from = h->done + (size_t)i * HASH_CHUNK;
+        jobs[i] = (struct hash_job){.data = buf + from, .size = len - from < HASH_CHUNK ? len - from : HASH_CHUNK};
+    }
+    for (int i = 0; i < n; i += batch) {
+        run_jobs(hash_main, jobs + i, sizeof(*jobs), min(batch, n - i));
+    }
+
+    h->leaves = alloc(h->leaves, (h->count + n) * sizeof(uint64_t));
+    for (int i = 0; i < n; i++) {
+        h->leaves[h->count++] = jobs[i].hash;
+    }
+    h->done += ready;
+    h->time += now() - begin;
+    free(jobs);
+}
+
+// root hash over leaves and format
+static uint64_t hash_done(struct hasher* h, int channels, int samplerate) {
+    uint64_t format[3] = {h->done, channels, samplerate};
+    uint64_t root      = xxh64(xxh64(0, format, sizeof(format)), h->leaves, h->count * sizeof(uint64_t));
+    free(h->leaves);
+    return root;
+}
+
+struct decoder {
+    struct scanner scan;
+    struct hasher  hash;
+    int            channels;
+};
+
+// scan and hash pcm chunk while the decoder produces the next one
+static void decode_chunk(void* ctx, const char* buf, int len) {
+    struct decoder* d = ctx;
+    scan_update(&d->scan, (const float*)buf, len / sizeof(float) / d->channels, false);
+    hash_update(&d->hash, buf, len, false);
+}
+
+// rate of the decoded pcm, with -o files keep their source rate but are resampled, streams only know the output rate
+static int pcm_rate(const struct track* t) {
+    return arg.device_rate ? arg.device_rate : t->samplerate;
+}
+
+// take decoded pcm into track, finish scan and hash started during decoding
+static void decode_done(struct track* t, struct decoder* d, struct buffer b, double s) {
+    t->length = b.size / sizeof(float) / t->channels;
+    t->pcm    = b.buf;
+    scan_update(&d->scan, t->pcm, t->length, true);
+    scan_done(&d->scan, t->length);
+    hash_update(&d->hash, b.buf, b.size, true);
+    t->hash = hash_done(&d->hash, t->channels, pcm_rate(t));
+    t->time[STAGE_DECODE] = now() - s;
+    t->time[STAGE_SCAN]   = d->scan.time;
+    t->time[STAGE_HASH]   = d->hash.time;
+}
+
+// drop decoder state after a failed decode, track stays empty
+static struct track decode_fail(struct decoder* d, const char* name, const char* err) {
+    printf("%s: %s\n", name, err);
+    free(d->scan.sum);
+    free(d->hash.leaves);
+    return (struct track){0};
+}
+
+// decode track from file into ram, empty track with message on error
+static struct track decode_track(char* name) {
+    struct track  t = {0};
+    struct buffer b = {0};
+    double        s = now();
+
+    // get info from ffprobe
+    b = slurp(NULL, NULL, "ffprobe -of flat -show_streams -select_streams a \"%s\"", name);
+    if (!b.buf) {
+        printf("%s: invalid audio file\n", name);
+        return t;
+    }
+
+    t.channels   = grep_int(b.buf, "streams.stream.0.channels=");
+    t.samplerate = grep_int(b.buf, "streams.stream.0.sample_rate=\"");
+    int duration = grep_int(b.buf, "streams.stream.0.duration=\"");
+    free(b.buf);
+    if (t.channels == 0 || t.samplerate == 0) {
+        printf("%s: invalid audio file\n", name);
+        return (struct track){0};
+    }
+    if (duration > MAX_LENGTH) {
+        printf("%s: too long\n", name);
+        return (struct track){0};
+    }
+    t.time[STAGE_PROBE] = now() - s;
+    s = now();
+
+    // get pcm data from ffmpeg
+    struct decoder d = {.channels = t.channels};
+    scan_init(&d.scan, &t.scan, t.channels);
+
+    char* en = isbig() ? "be" : "le";
+    int   sr = arg.device_rate;
+    if (sr) {
+        b = slurp(decode_chunk, &d, "ffmpeg -nostdin -i \"%s\" -af aresample=%d:resampler=soxr:precision=33 -f f32%s -", name, sr, en);
+    } else {
+        b = slurp(decode_chunk, &d, "ffmpeg -nostdin -i \"%s\" -f f32%s -", name, en);
+    }
+    if (!b.buf) {
+        return decode_fail(&d, name, "decoding failed");
+    }
+    decode_done(&t, &d, b, s);
+    t.name = name;
+    return t;
+}
+
+// stdin, file descriptor or named pipe, can be read only once
+static bool is_stream(const char* name) {
+    if (!strcmp(name, "-") || !strncmp(name, "fd:", 3)) {
+        return true;
+    }
+#ifndef _WIN32
+    struct stat st = {0};
+    return !stat(name, &st) && S_ISFIFO(st.st_mode);
+#else
+    return false;
+#endif
+}
+
+// read wav header up to the samples, false if not 32 bit float
+static bool read_wav(FILE* f, int* channels, int* samplerate) {
+    unsigned char h[16] = {0};
+    int           bits  = 0;
+    if (fread(h, 1, 12, f) != 12 || memcmp(h, "RIFF", 4) || memcmp(h + 8, "WAVE", 4)) {
+        return false;
+    }
+    for (;;) {
+        if (fread(h, 1, 8, f) != 8) {
+            return false;
+        }
+        uint32_t size = h[4] | h[5] << 8 | h[6] << 16 | (uint32_t)h[7] << 24;
+        if (!memcmp(h, "data", 4)) {
+            return *channels > 0 && *samplerate > 0 && bits == 32;
+        }
+        if (!memcmp(h, "fmt ", 4)) {
+            if (size < 16 || fread(h, 1, 16, f) != 16) {
+                return false;
+            }
+            *channels   = h[2] | h[3] << 8;
+            *samplerate = h[4] | h[5] << 8 | h[6] << 16 | h[7] << 24;
+            bits        = h[14] | h[15] << 8;
+            size -= 16;
+        }
+        // chunks are padded to even size
+        for (size += size & 1; size > 0; size--) {
+            if (fgetc(f) == EOF) {
+                return false;
+            }
+        }
+    }
+}
+
+// decode stdin, file descriptor or named pipe in one pass, format from the stream header, empty track on error
+static struct track decode_stream(char* name) {
+    struct track t            = {0};
+    char         in[0x1000]   = {0};
+    char         cmd[0x1100]  = {0};
+    double       s            = now();
+
+    if (isbig()) {
+        printf("%s: stream input needs a little endian machine\n", name);
+        return t;
+    }
+    if (!strcmp(name, "-")) {
+        snprintf(in, sizeof(in), "pipe:0");
+        stdin_read = true;
+    } else if (!strncmp(name, "fd:", 3)) {
+        snprintf(in, sizeof(in), "pipe:%d", atoi(name + 3));
+    } else {
+        snprintf(in, sizeof(in), "\"%s\"", name);
+    }
+    if (arg.device_rate) {
+        snprintf(cmd, sizeof(cmd), "ffmpeg -nostdin -i %s -af aresample=%d:resampler=soxr:precision=33 -c:a pcm_f32le -f wav -",
+                 in, arg.device_rate);
+    } else {
+        snprintf(cmd, sizeof(cmd), "ffmpeg -nostdin -i %s -c:a pcm_f32le -f wav -", in);
+    }
+
+    FILE* f = command_open(cmd);
+    if (!f) {
+        return t;
+    }
+    if (!read_wav(f, &t.channels, &t.samplerate)) {
+        pclose(f);
+        printf("%s: invalid audio stream\n", name);
+        return (struct track){0};
+    }
+    t.time[STAGE_PROBE] = now() - s;
+    s = now();
+
+    struct decoder d = {.channels = t.channels};
+    scan_init(&d.scan, &t.scan, t.channels);
+    struct buffer b = command_read(f, cmd, decode_chunk, &d);
+    if (!b.buf) {
+        return decode_fail(&d, name, "decoding failed");
+    }
+    decode_done(&t, &d, b, s);
+    t.name = name;
+    if (t.length > MAX_LENGTH * t.samplerate) {
+        printf("%s: too long\n", name);
+        free(t.pcm);
+        return (struct track){0};
+    }
+    return t;
+}
+
+#ifndef _WIN32
+
+// 64 bit FNV-1a hash
+static uint64_t fnv1a(uint64_t h, const void* data, size_t size) {
+    const unsigned char* p = data;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 0x100000001b3;
+    }
+    return h;
+}
+
+// identify source by location, size, modification time and output rate, false if not a regular file
+static bool file_id(const char* name, uint64_t* h) {
+    struct stat st  = {0};
+    char*       abs = realpath(name, NULL);
+    if (!abs || stat(abs, &st) || !S_ISREG(st.st_mode)) {
+        free(abs);
+        return false;
+    }
+
+    int64_t id[3] = {st.st_size, st.st_mtime, arg.device_rate};
+    *h = fnv1a(0xcbf29ce484222325, abs, strlen(abs));
+    *h = fnv1a(*h, id, sizeof(id));
+    free(abs);
+    return true;
+}
+
+// cache entry path for file, false if file can't be cached
+static bool cache_path(const char* name, char* path, size_t size) {
+    uint64_t h = 0;
+    if (!file_id(name, &h)) {
+        return false;
+    }
+    snprintf(path, size, "%s/%016llx.pcm", arg.cache_dir, (unsigned long long)h);
+    return true;
+}
+
+// lock cache entry, blocks while another process decodes it
+static int cache_lock(const char* path) {
+    char lock[0x1000] = {0};
+    snprintf(lock, sizeof(lock), "%.*s.lock", (int)strlen(path) - 4, path);
+
+    int fd = open(lock, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        return -1;
+    }
+    fchmod(fd, 0666); // shared between users, regardless of umask
+    flock(fd, LOCK_EX);
+    return fd;
+}
+
+// create temporary cache file that other users can touch and replace
+static FILE* cache_create(const char* tmp) {
+    FILE* f = fopen(tmp, "wb");
+    if (f) {
+        fchmod(fileno(f), 0666);
+    }
+    return f;
+}
+
+static void cache_unlock(int fd) {
+    if (fd >= 0) {
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+}
+
+// map cache entry with size bytes, zeros beyond end of file
+static void cache_map(struct track* t, size_t size) {
+    size_t pcm  = (size_t)t->length * t->channels * sizeof(float);
+    char*  base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        PANIC("out of memory\n");
+    }
+    if (pcm && mmap(base, pcm, PROT_READ, MAP_SHARED | MAP_FIXED, t->fd, CACHE_HEAD) == MAP_FAILED) {
+        PANIC("%s: cache mapping failed\n", t->name);
+    }
+    if (t->mapped) {
+        munmap(t->pcm, t->mapped);
+    }
+    t->pcm    = (float*)base;
+    t->mapped = size;
+}
+
+// map cache entry from open file, false and fd closed if invalid
+static bool cache_attach(int fd, struct track* t) {
+    struct cache_header h  = {0};
+    struct stat         st = {0};
+
+    // shared memory objects can only be mapped, not read
+    size_t               pcm = 0;
+    struct cache_header* m   = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size >= CACHE_HEAD) {
+        m = mmap(NULL, CACHE_HEAD, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (m != MAP_FAILED) {
+        h   = *m;
+        pcm = (size_t)h.length * h.channels * sizeof(float);
+        munmap(m, CACHE_HEAD);
+    }
+    if (memcmp(h.magic, "yuleq3", 7) || h.channels <= 0 || st.st_size != CACHE_HEAD + (off_t)pcm) {
+        close(fd);
+        return false;
+    }
+
+    t->channels   = h.channels;
+    t->samplerate = h.samplerate;
+    t->length     = h.length;
+    t->scan       = h.scan;
+    t->hash       = h.hash;
+    t->storage    = STORAGE_CACHE;
+    t->fd         = fd;
+    cache_map(t, pcm);
+    return true;
+}
+
+// open cache entry, false on miss
+static bool cache_open(const char* path, struct track* t) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || !cache_attach(fd, t)) {
+        return false;
+    }
+
+    utimes(path, NULL); // mark as recently used
+    return true;
+}
+
+// header block of cache entry, CACHE_HEAD bytes
+static void cache_head(const struct track* t, char* head) {
+    struct cache_header h = {
+        .magic      = "yuleq3",
+        .channels   = t->channels,
+        .samplerate = t->samplerate,
+        .length     = t->length,
+        .scan       = t->scan,
+        .hash       = t->hash,
+    };
+    memset(head, 0, CACHE_HEAD);
+    memcpy(head, &h, sizeof(h));
+}
+
+// publish decoded track as cache entry
+static void cache_store(const char* path, const struct track* t) {
+    char tmp[0x1000] = {0};
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+
+    char*  head = calloc(1, CACHE_HEAD);
+    size_t size = (size_t)t->length * t->channels * sizeof(float);
+    FILE*  f    = cache_create(tmp);
+    if (!f || !head) {
+        free(head);
+        return;
+    }
+    cache_head(t, head);
+
+    bool ok = fwrite(head, 1, CACHE_HEAD, f) == CACHE_HEAD && fwrite(t->pcm, 1, size, f) == size;
+    ok &= fclose(f) == 0;
+    free(head);
+
+    // rename is atomic, readers see either nothing or the complete entry
+    if (!ok || rename(tmp, path)) {
+        unlink(tmp);
+    }
+}
+
+struct cache_entry {
+    char   name[64];
+    off_t  size;
+    time_t time;
+};
+
+static int cache_cmp(const void* a, const void* b) {
+    const struct cache_entry* x = a;
+    const struct cache_entry* y = b;
+    return (x->time > y->time) - (x->time < y->time);
+}
+
+// evict least recently used files, entries as well as fingerprints and results, until cache fits size limit
+static void cache_evict(void) {
+    char path[0x1000] = {0};
+    snprintf(path, sizeof(path), "%s/evict.lock", arg.cache_dir);
+
+    // one process at a time, others skip
+    int lock = open(path, O_RDWR | O_CREAT, 0666);
+    if (lock >= 0) {
+        fchmod(lock, 0666);
+    }
+    if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB)) {
+        if (lock >= 0) {
+            close(lock);
+        }
+        return;
+    }
+
+    DIR* d = opendir(arg.cache_dir);
+    if (!d) {
+        cache_unlock(lock);
+        return;
+    }
+
+    struct cache_entry* e     = NULL;
+    int                 n     = 0;
+    off_t               total = 0;
+    struct dirent*      de    = NULL;
+
+    while ((de = readdir(d))) {
+        char*       ext = strrchr(de->d_name, '.');
+        struct stat st  = {0};
+        if (!ext || strlen(de->d_name) >= sizeof(e->name)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", arg.cache_dir, de->d_name);
+        if (stat(path, &st)) {
+            continue;
+        }
+
+        // remove temp files left behind by crashed processes
+        if (!strcmp(ext, ".tmp") && time(NULL) - st.st_mtime > CACHE_TEMP) {
+            unlink(path);
+        }
+
+        // lock files stay, removing one could let two processes decode the same entry under different locks
+        if (strcmp(ext, ".pcm") && strcmp(ext, ".fp") && strcmp(ext, ".res") && strcmp(ext, ".pair")) {
+            continue;
+        }
+
+        e = alloc(e, (n + 1) * sizeof(*e));
+        snprintf(e[n].name, sizeof(e->name), "%s", de->d_name);
+        e[n].size = st.st_size;
+        e[n].time = st.st_mtime;
+        total += st.st_size;
+        n += 1;
+    }
+    closedir(d);
+
+    // mapped entries stay valid for other processes after unlink
+    off_t limit = (off_t)(arg.cache_size ? arg.cache_size : CACHE_SIZE) << 20;
+    qsort(e, n, sizeof(*e), cache_cmp);
+    for (int i = 0; i < n && total > limit; i++) {
+        snprintf(path, sizeof(path), "%s/%s", arg.cache_dir, e[i].name);
+        if (arg.verbose) {
+            printf("cache evict %s\n", path);
+        }
+        unlink(path);
+        total -= e[i].size;
+    }
+
+    free(e);
+    cache_unlock(lock);
+}
+
+// unix socket of the daemon for this user
+static void daemon_path(char* path, size_t size) {
+    char* dir = getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir) {
+        snprintf(path, size, "%s/yuleq.sock", dir);
+    } else {
+        snprintf(path, size, "/tmp/yuleq-%d.sock", (int)getuid());
+    }
+}
+
+static int daemon_connect(void) {
+    struct sockaddr_un a = {.sun_family = AF_UNIX};
+    daemon_path(a.sun_path, sizeof(a.sun_path));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&a, sizeof(a))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// shared memory object of track decoded by daemon, named by content
+static void daemon_shm(uint64_t hash, char* name, size_t size) {
+    snprintf(name, size, "/yuleq-%016llx", (unsigned long long)hash);
+}
+
+// create shared memory object of given size and map it, replaces an existing one
+static void* shm_create(const char* name, size_t size) {
+    void* m = MAP_FAILED;
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd >= 0 && !ftruncate(fd, size)) {
+        m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return m == MAP_FAILED ? NULL : m;
+}
+
+// read one line from socket without newline, false on error
+static bool read_request(int fd, char* buf, size_t size) {
+    size_t n = 0;
+    while (n + 1 < size && read(fd, buf + n, 1) == 1) {
+        if (buf[n] == '\n') {
+            buf[n] = 0;
+            return true;
+        }
+        n += 1;
+    }
+    return false;
+}
+
+static bool write_all(int fd, const char* buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+// map track decoded by daemon, false if daemon is not running or can't load it
+static bool daemon_load(char* name, struct track* t) {
+    static atomic_bool warned;
+    char               buf[0x1000] = {0};
+    char               shm[64]     = {0};
+    char*              abs         = realpath(name, NULL);
+    int                fd          = abs ? daemon_connect() : -1;
+
+    if (fd < 0) {
+        if (abs && !atomic_exchange(&warned, true)) {
+            WARN("daemon not running, decoding locally\n");
+        }
+        free(abs);
+        return false;
+    }
+    int  n  = snprintf(buf, sizeof(buf), "%d %s\n", arg.device_rate, abs);
+    bool ok = n < (int)sizeof(buf) && write_all(fd, buf, n) && read_request(fd, buf, sizeof(buf));
+    close(fd);
+    free(abs);
+    if (!ok || buf[0] == '-') {
+        WARN("%s: daemon: %s, decoding locally\n", name, ok ? buf + 1 : "no reply");
+        return false;
+    }
+
+    uint64_t hash = strtoull(buf, NULL, 16);
+    daemon_shm(hash, shm, sizeof(shm));
+    fd = shm_open(shm, O_RDONLY, 0);
+    if (fd < 0 || !cache_attach(fd, t)) {
+        return false; // evicted meanwhile
+    }
+    return true;
+}
+
+#endif // _WIN32
+
+// load track from file or decode cache into ram, empty track with message on error
+static struct track try_load_track(char* name) {
+    if (is_stream(name)) {
+        return decode_stream(name);
+    }
+#ifndef _WIN32
+    struct track t = {.name = name};
+    char path[0x1000] = {0};
+    double s = now();
+
+    if (arg.use_daemon && daemon_load(name, &t)) {
+        t.time[STAGE_CACHE] = now() - s;
+        return t;
+    }
+
+    if (arg.cache_dir && cache_path(name, path, sizeof(path))) {
+        if (cache_open(path, &t)) {
+            t.time[STAGE_CACHE] = now() - s;
+            return t;
+        }
+
+        // decode once, concurrent processes wait for the entry
+        int lock = cache_lock(path);
+        if (!cache_open(path, &t)) {
+            struct track d = decode_track(name);
+            if (!d.channels) {
+                cache_unlock(lock);
+                return d;
+            }
+            cache_store(path, &d);
+            if (cache_open(path, &t)) {
+                free(d.pcm);
+                memcpy(t.time, d.time, sizeof(t.time));
+            } else {
+                t = d;
+            }
+            cache_evict();
+        }
+        cache_unlock(lock);
+        t.time[STAGE_CACHE] = now() - s - t.time[STAGE_PROBE] - t.time[STAGE_DECODE];
+        return t;
+    }
+#endif
+    return decode_track(name);
+}
+
+// load track, exits if it fails
+static struct track load_track(char* name) {
+    struct track t = try_load_track(name);
+    if (!t.channels) {
+        exit(1);
+    }
+    return t;
+}
+
+// extend buffer by zero padding
+static void pad_track(struct track* t, int bytes) {
+    int    size = t->length * t->channels * sizeof(float);
+    double s    = now();
+#ifndef _WIN32
+    if (t->storage == STORAGE_CACHE) {
+        cache_map(t, size + bytes);
+        t->time[STAGE_PAD] = now() - s;
+        return;
+    }
+#endif
+    t->pcm = alloc(t->pcm, size + bytes);
+    memset(t->pcm + t->length * t->channels, 0, bytes);
+    t->time[STAGE_PAD] = now() - s;
+}
+
+// frames in buffer including zero padding
+static int padded_length(const struct track* t) {
+    return max(t->length, player.length) + LATENCY * player.samplerate / 1000;
+}
+
+// move interleaved pcm into zero padded channel planes of given length
+static void planar_track(struct track* t, int frames) {
+    struct planes* k  = &t->planes;
+    int            ch = t->channels;
+    size_t         n  = PLANE_ALIGN / sizeof(float);
+    double         s  = now();
+
+    k->stride = (frames + 2 * PLANE_GUARD + n - 1) / n * n;
+    k->buf    = alloc(NULL, k->stride * ch * sizeof(float) + PLANE_ALIGN);
+    k->data   = (float*)(((uintptr_t)k->buf + PLANE_ALIGN - 1) & ~(uintptr_t)(PLANE_ALIGN - 1)) + PLANE_GUARD;
+    memset(k->data - PLANE_GUARD, 0, k->stride * ch * sizeof(float));
+    for (int c = 0; c < ch; c++) {
+        float* x = k->data + c * k->stride;
+        for (int i = 0; i < t->length; i++) {
+            x[i] = t->pcm[(size_t)i * ch + c];
+        }
+    }
+    free_pcm(t);
+    t->storage         = STORAGE_PLANAR;
+    t->time[STAGE_PAD] = now() - s;
+}
+
+// first sample of channel c and distance to the next sample of the channel
+static const float* channel(const struct track* t, int c, size_t* step) {
+    if (t->planes.data) {
+        *step = 1;
+        return t->planes.data + c * t->planes.stride;
+    }
+    *step = t->channels;
+    return t->pcm + c;
+}
+
+#ifndef _WIN32
+// place played pcm of track in shared memory, heap buffers are copied and replaced, other storage is decoded into a copy
+// named by slot, so blind tests don't reveal the load order
+static void export_track(struct track* t, int slot) {
+    int        ch     = t->channels;
+    int        frames = padded_length(t);
+    size_t     size   = (size_t)frames * ch * sizeof(float);
+    if (t->planes.data) {
+        size = t->planes.stride * ch * sizeof(float);
+    }
+
+    struct shared* x = &t->shared;
+    snprintf(x->name, sizeof(x->name), "/yuleq-%d-%d", (int)getpid(), slot);
+    x->base = shm_create(x->name, size);
+    x->size = size;
+    if (!x->base) {
+        WARN("%s: can't export to shared memory\n", t->name);
+        *x = (struct shared){0};
+        return;
+    }
+
+    if (t->planes.data) {
+        memcpy(x->base, t->planes.data - PLANE_GUARD, size);
+        free(t->planes.buf);
+        t->planes.buf  = x->base;
+        t->planes.data = (float*)x->base + PLANE_GUARD;
+    } else if (t->storage == STORAGE_HEAP) {
+        memcpy(x->base, t->pcm, size);
+        free(t->pcm);
+        t->pcm = x->base;
+    } else {
+        for (int p = 0; p < frames; p += DIFF_BLOCK) {
+            int n = min(DIFF_BLOCK, frames - p);
+            track_read(t, p, n, (float*)x->base + (size_t)p * ch);
+        }
+    }
+}
+
+static void unexport(void) {
+    char          name[32] = {0};
+    struct table* tab      = atomic_load(&table);
+    for (int i = 0; tab && i < MAX_TRACKS; i++) {
+        if (tab->tracks[i] && tab->tracks[i]->shared.base) {
+            shm_unlink(tab->tracks[i]->shared.name);
+        }
+    }
+    snprintf(name, sizeof(name), "/yuleq-%d", (int)getpid());
+    shm_unlink(name);
+}
+
+// create export descriptor, removed with all exported tracks at exit
+static void start_export(void) {
+    char name[32] = {0};
+    snprintf(name, sizeof(name), "/yuleq-%d", (int)getpid());
+    exported = shm_create(name, sizeof(*exported));
+    if (!exported) {
+        PANIC("can't create shared memory %s\n", name);
+    }
+    memcpy(exported->magic, EXPORT, 8);
+    atexit(unexport);
+}
+#endif
+
+struct bit_writer {
+    uint64_t* w;
+    size_t    words;
+    size_t    pos;
+};
+
+// append low n bits of x
+static void put_bits(struct bit_writer* b, uint64_t x, int n) {
+    size_t i = b->pos >> 6;
+    int    o = b->pos & 63;
+    if (i + 2 > b->words) {
+        size_t words = max(b->words * 2, 1024);
+        b->w = alloc(b->w, words * sizeof(uint64_t));
+        memset(b->w + b->words, 0, (words - b->words) * sizeof(uint64_t));
+        b->words = words;
+    }
+    b->w[i] |= x << o;
+    if (o + n > 64) {
+        b->w[i + 1] |= x >> (64 - o);
+    }
+    b->pos += n;
+}
+
+// replace pcm by rice coded residual against ref, quantized to 24 bit
+static void delta_track(struct track* t, struct track* ref) {
+    struct delta*     d      = &t->delta;
+    struct bit_writer b      = {0};
+    int               ch     = t->channels;
+    int               frames = padded_length(t);
+    int               blocks = (frames + DELTA_BLOCK - 1) / DELTA_BLOCK;
+    uint32_t*         u      = alloc(NULL, DELTA_BLOCK * ch * sizeof(uint32_t));
+    double            s      = now();
+
+    d->ref        = ref;
+    d->ref_frames = padded_length(ref);
+    d->frames     = frames;
+    d->offset     = alloc(NULL, blocks * sizeof(size_t));
+    d->param      = alloc(NULL, blocks);
+
+    for (int k = 0; k < blocks; k++) {
+        int      from = k * DELTA_BLOCK;
+        int      n    = min(DELTA_BLOCK, frames - from) * ch;
+        uint64_t sum  = 0;
+        for (int i = 0; i < n; i++) {
+            size_t j = (size_t)from * ch + i;
+            float  r = from + i / ch < d->ref_frames ? ref->pcm[j] : 0;
+            float  v = fmaxf(fminf((t->pcm[j] - r) * DELTA_SCALE, 1e9f), -1e9f);
+            int32_t q = (int32_t)lrintf(v);
+            u[i] = (uint32_t)q << 1 ^ (uint32_t)(q >> 31); // zigzag
+            sum += u[i];
+        }
+
+        // parameter near log2 of mean is close to optimal for laplacian residuals
+        int p = 0;
+        while (p < 31 && ((uint64_t)n << (p + 1)) < sum) {
+            p += 1;
+        }
+        d->offset[k] = b.pos;
+        d->param[k]  = (uint8_t)p;
+        for (int i = 0; i < n; i++) {
+            uint32_t q = u[i] >> p;
+            if (q >= DELTA_ESC) {
+                put_bits(&b, ((uint64_t)1 << DELTA_ESC) - 1, DELTA_ESC);
+                put_bits(&b, u[i], 32);
+            } else {
+                put_bits(&b, ((uint64_t)1 << q) - 1, q + 1);
+                put_bits(&b, u[i] & (((uint64_t)1 << p) - 1), p);
+            }
+        }
+    }
+    put_bits(&b, 0, 64); // reads may touch the word after the last bit
+
+    d->bits = alloc(b.w, ((b.pos + 63) >> 6) * sizeof(uint64_t));
+    d->size = ((b.pos + 63) >> 6) * sizeof(uint64_t) + blocks * (sizeof(size_t) + 1);
+    free(u);
+    free_pcm(t);
+    t->storage          = STORAGE_DELTA;
+    t->time[STAGE_CODE] = now() - s;
+}
+
+// replace pcm by blocks from the shared pool, adding blocks not seen before
+static void dedup_track(struct track* t) {
+    struct blocks* k      = &t->blocks;
+    int            ch     = t->channels;
+    int            frames = padded_length(t);
+    size_t         size   = (size_t)DEDUP_BLOCK * ch * sizeof(float);
+    float*         last   = alloc(NULL, size);
+    double         s      = now();
+
+    k->count = (frames + DEDUP_BLOCK - 1) / DEDUP_BLOCK;
+    k->data  = alloc(NULL, k->count * sizeof(float*));
+    k->hash  = alloc(NULL, k->count * sizeof(uint64_t));
+    for (int b = 0; b < k->count; b++) {
+        const float* x = t->pcm + (size_t)b * DEDUP_BLOCK * ch;
+        int          n = min(DEDUP_BLOCK, frames - b * DEDUP_BLOCK);
+        if (n < DEDUP_BLOCK) {
+            memset(last, 0, size);
+            memcpy(last, x, (size_t)n * ch * sizeof(float));
+            x = last;
+        }
+
+        uint64_t h = xxh64(0, x, size);
+        if ((pool.used + 1) * 2 > pool.size) {
+            pool_rehash();
+        }
+        struct pool_entry* e = &pool.slots[pool_slot(h, x, size)];
+        if (!e->data) {
+            e->hash = h;
+            e->data = alloc(NULL, size);
+            memcpy(e->data, x, size);
+            pool.used += 1;
+            k->unique += 1;
+        }
+        e->refs += 1;
+        k->data[b] = e->data;
+        k->hash[b] = h;
+    }
+    free(last);
+    free_pcm(t);
+    t->storage          = STORAGE_DEDUP;
+    t->time[STAGE_CODE] = now() - s;
+}
+
+// print level problems found by scan
+static void warn_track(const struct track* t, const struct track* ref) {
+    const struct scan* r = &t->scan;
+
+    if (r->clips) {
+        WARN("%s: %d clipped samples, peak %.1f dBFS, reduce gain before encoding\n", t->name, r->clips, 20 * log10(r->peak));
+    } else if (r->true_peak > 1.0f) {
+        WARN("%s: true peak %+.1f dBTP, decoder output may clip\n", t->name, 20 * log10(r->true_peak));
+    }
+    if (fabs(r->dc) > DC_LIMIT) {
+        WARN("%s: dc offset %.1f dBFS on channel %d\n", t->name, 20 * log10(fabs(r->dc)), r->dc_channel + 1);
+    }
+
+    // leading silence differs from reference, item is probably delayed
+    double ms = (r->first - ref->scan.first) * 1000.0 / player.samplerate;
+    if (t != ref && r->first < t->length && fabs(ms) >= ALIGN_MS) {
+        WARN("%s: starts %+.1f ms relative to %s, check alignment\n", t->name, ms, ref->name);
+    }
+}
+
+struct delay_job {
+    const struct track* ref;
+    const struct track* t;
+    int                 center; // window center frame
+    int                 shift;  // frames the track window is moved against the reference window
+    double              delay;  // measured delay in frames
+    double              weight; // correlation peak, 0 if invalid
+};
+
+// hann windowed mono mix of n frames around center, zero outside track
+static void mono_window(const struct track* t, int center, float* buf, int n) {
+    int ch = t->channels;
+    for (int i = 0; i < n; i++) {
+        int    f = center - n / 2 + i;
+        double v = 0;
+        for (int c = 0; f >= 0 && f < t->length && c < ch; c++) {
+            size_t step;
+            v += channel(t, c, &step)[f * step];
+        }
+        buf[i] = (float)(v / ch * (0.5 - 0.5 * cos(2 * M_PI * i / n)));
+    }
+}
+
+// delay of track against reference at one point by phase transform cross-correlation
+static void* delay_main(void* ptr) {
+    struct delay_job* job = ptr;
+    int               n   = DRIFT_SIZE;
+    struct fft*       fwd = fft_new(2 * n, false);
+    struct fft*       inv = fft_new(2 * n, true);
+    float*            a   = alloc(NULL, 2 * n * sizeof(float));
+    float*            b   = alloc(NULL, 2 * n * sizeof(float));
+    struct cpx*       fa  = alloc(NULL, (n + 1) * sizeof(struct cpx));
+    struct cpx*       fb  = alloc(NULL, (n + 1) * sizeof(struct cpx));
+
+    memset(a + n, 0, n * sizeof(float));
+    memset(b + n, 0, n * sizeof(float));
+    mono_window(job->ref, job->center, a, n);
+    mono_window(job->t, job->center + job->shift, b, n);
+    fft_real(fwd, a, fa);
+    fft_real(fwd, b, fb);
+
+    // whitened cross spectrum gives a sharp peak at the delay
+    for (int k = 0; k <= n; k++) {
+        struct cpx c = cmul(conj_(fa[k]), fb[k]);
+        float      m = sqrtf(c.re * c.re + c.im * c.im) + 1e-20f;
+        fa[k] = (struct cpx){c.re / m, c.im / m};
+    }
+    fft_real_inverse(inv, fa, a);
+
+    // lag l is at index l, negative lags wrap around
+    int best = 0;
+    for (int l = -n / 4; l <= n / 4; l++) {
+        if (a[(l + 2 * n) % (2 * n)] > a[(best + 2 * n) % (2 * n)]) {
+            best = l;
+        }
+    }
+    double y0 = a[(best - 1 + 2 * n) % (2 * n)];
+    double y1 = a[(best + 2 * n) % (2 * n)];
+    double y2 = a[(best + 1 + 2 * n) % (2 * n)];
+    double d  = y0 - 2 * y1 + y2;
+
+    job->delay  = best + (d < 0 ? 0.5 * (y0 - y2) / d : 0);
+    job->weight = y1 / (2 * n); // fraction of coherent bins
+    job->weight = job->weight >= DRIFT_MIN ? job->weight : 0;
+
+    fft_free(fwd);
+    fft_free(inv);
+    free(a);
+    free(b);
+    free(fa);
+    free(fb);
+    return NULL;
+}
+
+// weighted least squares line delay = offset + drift * center
+static bool fit_line(const struct delay_job* jobs, int n, double* offset, double* drift) {
+    double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = 0; i < n; i++) {
+        double w = jobs[i].weight;
+        double x = jobs[i].center;
+        sw  += w;
+        sx  += w * x;
+        sy  += w * jobs[i].delay;
+        sxx += w * x * x;
+        sxy += w * x * jobs[i].delay;
+    }
+    double det = sw * sxx - sx * sx;
+    if (sw <= 0 || fabs(det) < 1e-9) {
+        return false;
+    }
+    *drift  = (sw * sxy - sx * sy) / det;
+    *offset = (sy - *drift * sx) / sw;
+    return true;
+}
+
+static double bessel_i0(double x) {
+    double sum  = 1;
+    double term = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+struct resample_job {
+    const struct track* src;
+    float*              dst;
+    const float*        kernel; // (SINC_RES + 1) phases of 2 * SINC_TAPS taps
+    int                 from;   // first output frame
+    int                 to;     // end output frame
+    double              offset; // source position of output frame 0
+    double              ratio;  // source frames per output frame
+};
+
+// windowed sinc interpolation at source position offset + n * ratio
+static void* resample_main(void* ptr) {
+    struct resample_job* job = ptr;
+    const struct track*  t   = job->src;
+    int                  ch  = t->channels;
+    float                h[2 * SINC_TAPS];
+
+    for (int n = job->from; n < job->to; n++) {
+        double pos  = job->offset + n * job->ratio;
+        int    i    = (int)floor(pos);
+        double q    = (pos - i) * SINC_RES;
+        int    qi   = (int)q;
+        float  qf   = (float)(q - qi);
+        int    base = i - SINC_TAPS + 1;
+
+        const float* k0 = job->kernel + qi * 2 * SINC_TAPS;
+        const float* k1 = k0 + 2 * SINC_TAPS;
+        for (int k = 0; k < 2 * SINC_TAPS; k++) {
+            h[k] = k0[k] + qf * (k1[k] - k0[k]);
+        }
+
+        for (int c = 0; c < ch; c++) {
+            float y = 0;
+            if (base >= 0 && base + 2 * SINC_TAPS <= t->length) {
+                const float* x = t->pcm + base * ch + c;
+                for (int k = 0; k < 2 * SINC_TAPS; k++) {
+                    y += h[k] * x[k * ch];
+                }
+            } else {
+                for (int k = max(-base, 0); k < 2 * SINC_TAPS && base + k < t->length; k++) {
+                    y += h[k] * t->pcm[(base + k) * ch + c];
+                }
+            }
+            job->dst[n * ch + c] = y;
+        }
+    }
+    return NULL;
+}
+
+// measure delay and drift against reference and resample track to match it
+static void drift_track(struct track* t, const struct track* ref) {
+    struct delay_job jobs[DRIFT_NUM];
+    int              len = min(t->length, ref->length);
+
+    for (int i = 0; i < DRIFT_NUM; i++) {
+        jobs[i] = (struct delay_job){.ref = ref, .t = t, .center = (int)((i + 0.5) * len / DRIFT_NUM)};
+    }
+    run_jobs(delay_main, jobs, sizeof(*jobs), DRIFT_NUM);
+
+    // fit, drop outliers from misdetected peaks, fit again
+    double offset = 0;
+    double drift  = 0;
+    bool   ok     = fit_line(jobs, DRIFT_NUM, &offset, &drift);
+    for (int i = 0; ok && i < DRIFT_NUM; i++) {
+        if (fabs(jobs[i].delay - offset - drift * jobs[i].center) > 2) {
+            jobs[i].weight = 0;
+        }
+    }
+    int valid = 0;
+    for (int i = 0; i < DRIFT_NUM; i++) {
+        valid += jobs[i].weight > 0;
+    }
+    if (!ok || valid < DRIFT_NUM / 4 || !fit_line(jobs, DRIFT_NUM, &offset, &drift)) {
+        WARN("%s: no reliable delay found against %s\n", t->name, ref->name);
+        return;
+    }
+    if (fabs(drift) * 1e6 < DRIFT_PPM && fabs(offset) < 0.01) {
+        return;
+    }
+
+    // kaiser windowed sinc, cutoff slightly below nyquist
+    float* kernel = alloc(NULL, (SINC_RES + 1) * 2 * SINC_TAPS * sizeof(float));
+    double fc     = 0.97;
+    for (int q = 0; q <= SINC_RES; q++) {
+        for (int k = 0; k < 2 * SINC_TAPS; k++) {
+            double x = k - SINC_TAPS + 1 - (double)q / SINC_RES;
+            double r = x / SINC_TAPS;
+            double w = fabs(r) < 1 ? bessel_i0(9 * sqrt(1 - r * r)) / bessel_i0(9) : 0;
+            double s = x == 0 ? 1 : sin(M_PI * fc * x) / (M_PI * fc * x);
+            kernel[q * 2 * SINC_TAPS + k] = (float)(fc * s * w);
+        }
+    }
+
+    // output frame n plays source position n + offset + drift * n
+    int                  n    = cpus();
+    int                  ch   = t->channels;
+    float*               dst  = alloc(NULL, (size_t)t->length * ch * sizeof(float));
+    struct resample_job* work = alloc(NULL, n * sizeof(*work));
+    for (int i = 0; i < n; i++) {
+        work[i] = (struct resample_job){t, dst, kernel, (int)((int64_t)t->length * i / n),
+                                        (int)((int64_t)t->length * (i + 1) / n), offset, 1 + drift};
+    }
+    run_jobs(resample_main, work, sizeof(*work), n);
+    free(work);
+    free(kernel);
+
+    free_track(t);
+    t->pcm     = dst;
+    t->storage = STORAGE_HEAP;
+    t->mapped  = 0;
+
+    struct scanner sc;
+    scan_init(&sc, &t->scan, ch);
+    scan_update(&sc, t->pcm, t->length, true);
+    scan_done(&sc, t->length);
+
+    // corrected pcm is different content, so it must not share cache or analysis results with the original
+    struct hasher h = {0};
+    hash_update(&h, (const char*)t->pcm, (size_t)t->length * ch * sizeof(float), true);
+    t->hash = hash_done(&h, ch, pcm_rate(t));
+
+    WARN("%s: drift %+.2f ppm, offset %+.3f ms, corrected\n", t->name, drift * 1e6, offset * 1000 / pcm_rate(t));
+}
+
+struct load_job {
+    char*        name;
+    struct track track;
+};
+
+static void* load_main(void* ptr) {
+    struct load_job* job = ptr;
+    job->track = load_track(job->name);
+    if (job->name == arg.files[0]) {
+        publish_format(&job->track);
+    }
+    return NULL;
+}
+
+static void load_tracks(void) {
+    if (arg.num_files == 0) {
+        PANIC("no input files\n");
+    }
+    if (arg.num_files > MAX_TRACKS) {
+        PANIC("too many files\n");
+    }
+    struct player* p   = &player;
+    struct table*  tab = alloc(NULL, sizeof(*tab));
+    memset(tab, 0, sizeof(*tab));
+
+#ifndef _WIN32
+    if (arg.cache_dir) {
+        mkdir(arg.cache_dir, 0777);
+    }
+#endif
+
+    // decode and scan all files in parallel
+    struct load_job jobs[MAX_TRACKS];
+    for (int i = 0; i < arg.num_files; i++) {
+        jobs[i].name = arg.files[i];
+    }
+    run_jobs(load_main, jobs, sizeof(*jobs), arg.num_files);
+
+    for (int i = 0; i < arg.num_files; i++) {
+        struct track* t  = alloc(NULL, sizeof(*t));
+        struct track* t0 = i ? tab->tracks[0] : t;
+
+        *t = jobs[i].track;
+        tab->tracks[i] = t;
+
+        // first track determines length, channels, rate
+        if (t->length != t0->length) {
+            WARN("%s: length mismatch, got %d, expected %d\n", t->name, t->length, t0->length);
+        }
+        if (t->channels != t0->channels) {
+            PANIC("%s: channel mismatch, got %d, expected %d\n", t->name, t->channels, t0->channels);
+        }
+        if (pcm_rate(t) != pcm_rate(t0)) {
+            PANIC("%s: samplerate mismatch, got %d, expected %d\n", t->name, t->samplerate, t0->samplerate);
+        }
+
+        if (i == 0) {
+            p->length     = t->length;
+            p->channels   = t->channels;
+            p->outputs    = t->channels;
+            p->samplerate = arg.device_rate ? arg.device_rate : t->samplerate;
+        } else if (arg.drift) {
+            drift_track(t, t0);
+        }
+
+        // apply zero padding to end of buffer
+        int samples = LATENCY * player.samplerate / 1000;
+        if (t->length < p->length) {
+            samples += p->length - t->length;
+        }
+        if (arg.storage == STORAGE_PLANAR) {
+            planar_track(t, padded_length(t));
+        } else {
+            pad_track(t, samples * t->channels * sizeof(float));
+        }
+        warn_track(t, t0);
+        if (arg.storage == STORAGE_DELTA && i > 0) {
+            delta_track(t, t0);
+        } else if (arg.storage == STORAGE_DEDUP) {
+            dedup_track(t);
+        }
+    }
+    atomic_store(&table, tab);
+}
+
+// split filter channels into spectra of buffer sized partitions
+static void conv_init(struct conv* cv, struct track* t, int inputs, int outputs, bool matrix) {
+    int m = LATENCY * player.samplerate / 1000;
+
+    if (!arg.device_rate && t->samplerate != player.samplerate) {
+        PANIC("%s: filter samplerate mismatch, got %d, expected %d\n", t->name, t->samplerate, player.samplerate);
+    }
+    if (t->length > CONV_TAPS) {
+        PANIC("%s: filter too long, got %d taps, max %d\n", t->name, t->length, CONV_TAPS);
+    }
+
+    cv->size    = m;
+    cv->parts   = (t->length + m - 1) / m;
+    cv->bins    = (m + 4) & ~3;
+    cv->slots   = cv->parts + CONV_HEAD + 1;
+    cv->inputs  = inputs;
+    cv->outputs = outputs;
+    cv->filters = t->channels;
+    cv->matrix  = matrix;
+    cv->fwd     = fft_rt(2 * m, false);
+    cv->inv     = fft_rt(2 * m, true);
+
+    size_t bins = 2 * cv->bins;
+    cv->h    = rt_alloc((size_t)cv->filters * cv->parts * bins * sizeof(float));
+    cv->x    = rt_alloc((size_t)inputs * cv->slots * bins * sizeof(float));
+    cv->tail = rt_alloc((size_t)(CONV_HEAD + 1) * outputs * bins * sizeof(float));
+    cv->acc  = rt_alloc(bins * sizeof(float));
+    cv->in   = rt_alloc((size_t)inputs * 2 * m * sizeof(float));
+    cv->buf  = rt_alloc(2 * m * sizeof(float));
+    cv->spec = rt_alloc((m + 1) * sizeof(struct cpx));
+    cv->lo   = rt_alloc((size_t)(CONV_HEAD + 1) * outputs * bins * sizeof(float));
+    cv->fade = rt_alloc((size_t)m * outputs * sizeof(float));
+    cv->win  = rt_alloc(m * sizeof(float));
+
+    for (int i = 0; i < m; i++) {
+        cv->win[i] = (float)(0.5 + 0.5 * cos(M_PI * i / m));
+    }
+
+    // inverse transform is scaled by 2 * m, fold that into the filter
+    for (int c = 0; c < cv->filters; c++) {
+        for (int p = 0; p < cv->parts; p++) {
+            float* h = cv->h + ((size_t)c * cv->parts + p) * bins;
+            memset(cv->buf, 0, 2 * m * sizeof(float));
+            for (int i = 0; i < m && p * m + i < t->length; i++) {
+                cv->buf[i] = t->pcm[(p * m + i) * t->channels + c] / (2.0f * m);
+            }
+            fft_real(cv->fwd, cv->buf, cv->spec);
+            for (int i = 0; i <= m; i++) {
+                h[i]            = cv->spec[i].re;
+                h[cv->bins + i] = cv->spec[i].im;
+            }
+        }
+    }
+
+    atomic_init(&cv->avail, -1);
+    atomic_init(&cv->claimed, -1);
+    atomic_init(&cv->done, -1);
+    atomic_init(&cv->quality, 2);
+    atomic_init(&cv->computed, 2);
+    cv->played = 2;
+    if (cv->parts > CONV_HEAD) {
+        spawn(conv_main, cv);
+    }
+}
+
+// render track channels to stereo with a left and right impulse response per channel
+static void load_hrir(void) {
+    struct track t  = load_track(arg.hrir);
+    int          ch = player.channels;
+
+    if (t.channels != 2 * ch) {
+        PANIC("%s: impulse response channel mismatch, got %d, expected %d\n", t.name, t.channels, 2 * ch);
+    }
+    conv_init(&binaural, &t, ch, 2, true);
+    free_track(&t);
+
+    player.outputs = 2;
+    player.mix     = rt_alloc((size_t)binaural.size * ch * sizeof(float));
+}
+
+// correction filter applied to the output, one channel for all or one per output
+static void load_filter(void) {
+    struct track t  = load_track(arg.filter);
+    int          ch = player.outputs;
+
+    if (t.channels != 1 && t.channels != ch) {
+        PANIC("%s: filter channel mismatch, got %d, expected 1 or %d\n", t.name, t.channels, ch);
+    }
+    conv_init(&correction, &t, ch, ch, false);
+    free_track(&t);
+}
+
+// fault in bookmarked regions of all tracks and keep them resident
+static void lock_bookmarks(void) {
+#ifndef _WIN32
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    int    pad  = LATENCY * player.samplerate / 1000;
+
+    struct table* tab = atomic_load(&table);
+
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        struct track* t = tab->tracks[i];
+        if (!t || (!t->pcm && !t->planes.data)) {
+            continue; // delta and dedup tracks are small and decoded on the fly
+        }
+
+        // interleaved pcm is one run of ch floats per frame, planar tracks one run of 1 float per frame per channel
+        int    ch     = t->channels;
+        bool   planar = t->planes.data;
+        int    runs   = planar ? ch : 1;
+        int    width  = planar ? 1 : ch;
+        int    frames = planar ? (int)t->planes.stride - PLANE_GUARD : player.length + pad;
+        float* first  = planar ? t->planes.buf : t->pcm;
+        float* last   = planar ? t->planes.data + t->planes.stride * (ch - 1) + frames : t->pcm + frames * ch;
+
+        // locks don't nest, unlock all and lock current bookmarks again
+        uintptr_t lo = (uintptr_t)first & ~(page - 1);
+        munlock((void*)lo, (uintptr_t)last - lo);
+
+        for (int b = 0; b < BOOKMARKS; b++) {
+            if (!bookmarks[b].set) {
+                continue;
+            }
+            for (int r = 0; r < runs; r++) {
+                float*          base = planar ? t->planes.data + t->planes.stride * r : t->pcm;
+                volatile float* p    = base + bookmarks[b].start * width;
+                volatile float* e    = base + min(bookmarks[b].end + pad, frames) * width;
+                lo                   = (uintptr_t)p & ~(page - 1);
+
+                madvise((void*)lo, (uintptr_t)e - lo, MADV_WILLNEED);
+                for (; p < e; p += page / sizeof(float)) {
+                    (void)*p; // touch pages, mlock may be denied by rlimit
+                }
+                mlock((void*)lo, (uintptr_t)e - lo);
+            }
+        }
+    }
+#endif
+}
+
+// store or recall loop bookmark
+static void use_bookmark(char cmd, int b) {
+    struct bookmark* m = &bookmarks[b];
+
+    if (cmd == 'm') {
+        m->start = player.start;
+        m->end   = player.end;
+        m->set   = true;
+        lock_bookmarks();
+    } else if (m->set) {
+        player.start = m->start;
+        player.end   = m->end;
+        player.seek  = m->start;
+    }
+}
+
+static void shuffle_tracks(bool skip_first) {
+    srand((unsigned)time(NULL));
+    int            n      = arg.num_files;
+    struct track** tracks = atomic_load(&table)->tracks;
+
+    for (int i = (int)skip_first; i < n - 1; i++) {
+        int j = i + (int)(rand() / (RAND_MAX + 1.0) * (n - i));
+        struct track* t = tracks[i];
+        tracks[i] = tracks[j];
+        tracks[j] = t;
+    }
+}
+
+#ifdef _WIN32
+
+static void init_terminal(void) {
+    DWORD m = 0;
+    GetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), &m);
+    m &= ~(ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT | ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT);
+    SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), m);
+    GetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), &m);
+    m |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
+    SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), m);
+    write(1, "\33[?25l", 6); // hide cursor
+}
+
+static void restore_terminal(void) {
+    DWORD m = 0;
+    GetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), &m);
+    m |= ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT;
+    SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), m);
+    write(1, "\33[?25h\n", 7); // show cursor
+    GetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), &m);
+    m &= ~ENABLE_VIRTUAL_TERMINAL_PROCESSING;
+    SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), m);
+}
+
+static char read_key(void) {
+    HANDLE h = GetStdHandle(STD_INPUT_HANDLE);
+    if (WaitForSingleObject(h, 100) == WAIT_TIMEOUT) {
+        return 0;
+    }
+    DWORD        n    = 0;
+    INPUT_RECORD r[1] = {0};
+    ReadConsoleInput(h, r, 1, &n);
+    if (r[0].EventType != KEY_EVENT || !r[0].Event.KeyEvent.bKeyDown) {
+        return 0;
+    }
+    return r[0].Event.KeyEvent.uChar.AsciiChar;
+}
+
+#else // _WIN32
+
+static void init_terminal(void) {
+    // keys come from the terminal when stdin carried audio
+    int tty = stdin_read ? open("/dev/tty", O_RDONLY) : -1;
+    if (tty >= 0) {
+        dup2(tty, 0);
+        close(tty);
+    }
+    struct termios a = { 0 };
+    tcgetattr(0, &a);
+    a.c_lflag &= ~(ICANON | ECHO); // unbuffered, echo off
+    a.c_cc[VMIN]  = 0;             // 100 ms read timeout
+    a.c_cc[VTIME] = 1;
+    tcsetattr(0, TCSANOW, &a);
+    write(1, "\33[?25l", 6); // hide cursor
+}
+
+static void restore_terminal(void) {
+    struct termios a = { 0 };
+    tcgetattr(0, &a);
+    a.c_lflag |= (ICANON | ECHO); // buffered, echo on
+    tcsetattr(0, TCSANOW, &a);
+    write(1, "\33[?25h\n", 7); // display cursor
+}
+
+static char read_key(void) {
+    char ch = 0;
+    read(0, &ch, 1);
+    return ch;
+}
+
+#endif // _WIN32
+
+static void clear_terminal(void) {
+    write(1, "\33[H\33[J", 6);
+}
+
+static void print_progress(void) {
+    char buf[81];
+
+    int pos   = player.pos * 80 / player.length;
+    int start = player.start * 80 / player.length;
+    int end   = (player.end - 1) * 80 / player.length;
+
+    for (int i = 0; i < 80; i++) {
+        if (i == pos) {
+            buf[i] = '0' + (player.track + 1) % 10;
+        } else if (i == start) {
+            buf[i] = '[';
+        } else if (i == end) {
+            buf[i] = ']';
+        } else {
+            buf[i] = '-';
+        }
+    }
+    buf[80]='\r';
+
+    write(1, buf, 81);
+}
+
+static void print_files(bool reference, bool blind) {
+    struct table* tab = atomic_load(&table);
+
+    if (reference && tab->tracks[0]) {
+        printf("[1] reference\n");
+    }
+    for (int i = (int)reference; i < MAX_TRACKS; i++) {
+        if (!tab->tracks[i]) {
+            continue;
+        }
+        char* name = blind ? "???" : tab->tracks[i]->name;
+        printf("[%d] %s\n", (i + 1) % 10, name);
+    }
+}
+
+static void print_info(void) {
+    printf("--------------------------------------------------------------------------------\n");
+    print_files(arg.refblind, arg.blind || arg.refblind);
+    printf("--------------------------------------------------------------------------------\n"
+           "[s] start  [x] clear  [i/o] adjust  [q]     quit                     %d channels\n"
+           "[d] end    [c] clear  [k/l] adjust  [space] pause                    %d Hz\n"
+           "[m n] store loop n  [' n] recall loop n  [a] add track  [r] remove track  [t] stats\n"
+           "[e] smooth loop seam  [n] next different passage  [y] cycle tracks at loop seam\n",
+           player.channels, player.samplerate);
+    if (arg.export) {
+        printf("exported to shared memory /yuleq-%d\n", (int)getpid());
+    }
+}
+
+// energy of difference per sample, optionally pre-emphasized
+static double diff_energy(const float* a, const float* b, int n, int ch, float k) {
+    float sum = 0;
+    int   i   = 0;
+    for (; i < ch && i < n; i++) {
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+#ifdef __SSE2__
+    __m128 acc = _mm_setzero_ps();
+    __m128 kk  = _mm_set1_ps(k);
+    for (; i + 4 <= n; i += 4) {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        __m128 p = _mm_sub_ps(_mm_loadu_ps(a + i - ch), _mm_loadu_ps(b + i - ch));
+        __m128 e = _mm_sub_ps(d, _mm_mul_ps(kk, p));
+        acc = _mm_add_ps(acc, _mm_mul_ps(e, e));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; i++) {
+        float e = (a[i] - b[i]) - k * (a[i - ch] - b[i - ch]);
+        sum += e * e;
+    }
+    return (double)sum / max(n, 1);
+}
+
+// analyze blocks in time order, so the start of the tracks is ranked first
+static void* diff_main(void* ptr) {
+    int    ch   = player.channels;
+    int    size = DIFF_BLOCK * player.samplerate / 1000;
+    float  k    = arg.emphasis ? DIFF_EMPH : 0;
+    float* buf  = alloc(NULL, 2 * (size_t)size * ch * sizeof(float));
+
+    for (;;) {
+        int b = atomic_fetch_add(&diff.next, 1);
+        if (b >= diff.blocks || atomic_load(&diff.cancel)) {
+            break;
+        }
+        int          from = b * size;
+        int          n    = min(size, player.length - from);
+        const float* a    = track_span(diff.ref, from, n, buf);
+        for (int i = 0; i < MAX_TRACKS; i++) {
+            struct track* t = diff.tab->tracks[i];
+            if (!t || t == diff.ref || !isnan(atomic_load_explicit(&diff.score[i][b], memory_order_relaxed))) {
+                continue;
+            }
+            double e = diff_energy(a, track_span(t, from, n, buf + (size_t)size * ch), n * ch, ch, k);
+            atomic_store_explicit(&diff.score[i][b], (float)(10 * log10(e + 1e-20)), memory_order_relaxed);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+// stop analysis before the table changes
+static void stop_diff(void) {
+    atomic_store(&diff.cancel, true);
+    for (int i = 0; i < diff.threads; i++) {
+        join(diff.thread[i]);
+    }
+    diff.threads = 0;
+}
+
+// analyze current table, scores of unchanged tracks are kept
+static void start_diff(void) {
+    struct table* tab  = atomic_load(&table);
+    int           size = DIFF_BLOCK * player.samplerate / 1000;
+    struct track* ref  = NULL;
+
+    for (int i = 0; i < MAX_TRACKS && !ref; i++) {
+        ref = tab->tracks[i];
+    }
+    diff.blocks = (player.length + size - 1) / size;
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        if (!diff.score[i]) {
+            diff.score[i] = alloc(NULL, diff.blocks * sizeof(*diff.score[i]));
+            diff.of[i]    = NULL;
+        }
+        if (diff.of[i] != tab->tracks[i] || diff.ref != ref) {
+            for (int b = 0; b < diff.blocks; b++) {
+                atomic_init(&diff.score[i][b], NAN);
+            }
+            diff.of[i] = tab->tracks[i];
+        }
+    }
+    diff.ref  = ref;
+    diff.tab  = tab;
+    diff.rank = -1;
+    atomic_store(&diff.next, 0);
+    atomic_store(&diff.cancel, false);
+
+    diff.threads = min(max(cpus() - 1, 1), (int)(sizeof(diff.thread) / sizeof(*diff.thread)));
+    for (int i = 0; i < diff.threads; i++) {
+        diff.thread[i] = spawn(diff_main, NULL);
+    }
+}
+
+// publish new track table and wait until the audio thread is done with the old one
+static void swap_table(struct table* tab) {
+    stop_diff();
+    struct table* old = atomic_exchange(&table, tab);
+    unsigned      e   = atomic_load(&epoch);
+
+    // any callback still holding the old table completes before epoch changes
+    while (Pa_IsStreamActive(stream) == 1 && atomic_load(&epoch) == e) {
+        Pa_Sleep(1);
+    }
+    free(old);
+    start_diff();
+}
+
+// add loaded track to first free slot
+static void add_track(struct track t) {
+    struct table* tab  = alloc(NULL, sizeof(*tab));
+    struct track* ref  = NULL;
+    int           slot = -1;
+
+    *tab = *atomic_load(&table);
+    for (int i = MAX_TRACKS - 1; i >= 0; i--) {
+        if (tab->tracks[i]) {
+            ref = tab->tracks[i];
+        } else {
+            slot = i;
+        }
+    }
+
+    char* err = NULL;
+    if (slot < 0) {
+        err = "too many tracks";
+    } else if (t.channels != player.channels) {
+        err = "channel mismatch";
+    } else if (ref && pcm_rate(&t) != pcm_rate(ref)) {
+        err = "samplerate mismatch";
+    }
+    if (err) {
+        printf("%s: %s\n", t.name, err);
+        free_track(&t);
+        free(tab);
+        return;
+    }
+
+    if (t.length != player.length) {
+        printf("%s: length mismatch, got %d, expected %d\n", t.name, t.length, player.length);
+    }
+    if (arg.drift && ref) {
+        drift_track(&t, ref);
+    }
+    int samples = LATENCY * player.samplerate / 1000 + max(player.length - t.length, 0);
+    if (arg.storage == STORAGE_PLANAR) {
+        planar_track(&t, padded_length(&t));
+    } else {
+        pad_track(&t, samples * t.channels * sizeof(float));
+    }
+
+    warn_track(&t, ref ? ref : &t);
+
+    if (arg.storage == STORAGE_DEDUP) {
+        dedup_track(&t);
+    }
+    // code against first track that isn't coded itself
+    for (int i = 0; i < MAX_TRACKS && arg.storage == STORAGE_DELTA; i++) {
+        if (tab->tracks[i] && !tab->tracks[i]->delta.ref) {
+            delta_track(&t, tab->tracks[i]);
+            break;
+        }
+    }
+#ifndef _WIN32
+    if (arg.export) {
+        export_track(&t, slot);
+    }
+#endif
+
+    tab->tracks[slot]  = alloc(NULL, sizeof(t));
+    *tab->tracks[slot] = t;
+    swap_table(tab);
+    lock_bookmarks();
+}
+
+// drop queued switches, returns once the audio thread can't execute them anymore
+static void flush_events(void) {
+    atomic_store(&events.flush, true);
+    while (atomic_load(&events.flush) && Pa_IsStreamActive(stream) == 1) {
+        Pa_Sleep(1);
+    }
+    events.last = player.next;
+}
+
+// keep switches for the next loops queued while cycling
+static void poll_cycle(void) {
+    struct table* tab = atomic_load(&table);
+    while (events.cycle && atomic_load(&events.tail) - atomic_load(&events.head) < MAX_TRACKS) {
+        int i = events.last;
+        do {
+            i = (i + 1) % MAX_TRACKS;
+        } while (!tab->tracks[i]);
+        events.last = i;
+        post_event((struct event){.track = i, .wrap = true});
+    }
+}
+
+// remove track from its slot, switching away from it first
+static void remove_track(int slot) {
+    struct table* tab   = alloc(NULL, sizeof(*tab));
+    int           other = -1;
+
+    *tab = *atomic_load(&table);
+    for (int i = 0; i < MAX_TRACKS && other < 0; i++) {
+        if (tab->tracks[i] && i != slot) {
+            other = i;
+        }
+    }
+    if (other < 0) {
+        free(tab);
+        return;
+    }
+    struct track* t = tab->tracks[slot];
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        if (tab->tracks[i] && tab->tracks[i]->delta.ref == t) {
+            printf("%s: reference of coded tracks, can't remove\n", t->name);
+            free(tab);
+            return;
+        }
+    }
+
+    flush_events();
+    if (player.track == slot || player.next == slot) {
+        player.next = other;
+        while (player.track != other && !player.paused && Pa_IsStreamActive(stream) == 1) {
+            Pa_Sleep(1);
+        }
+        player.track = other;
+    }
+
+    tab->tracks[slot] = NULL;
+    swap_table(tab);
+    free_track(t);
+    free(t);
+}
+
+static void* loader_main(void* ptr) {
+    loader.track = try_load_track(loader.name);
+    atomic_store(&loader.done, true);
+    return NULL;
+}
+
+static float dot(const float* a, const float* b, int n) {
+    float sum = 0;
+    int   i   = 0;
+#ifdef __SSE2__
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// normalized cross-correlation of every candidate end against loop start
+static void* seam_main(void* ptr) {
+    int    ch = player.channels;
+    int    n  = seam.len;
+    double eb = dot(seam.b, seam.b, n);
+    double ea = dot(seam.a, seam.a, n);
+
+    seam.best  = seam.end;
+    seam.score = -2;
+    for (int j = 0; j < seam.count; j++) {
+        const float* a = seam.a + j * ch;
+        double       s = dot(a, seam.b, n) / sqrt(ea * eb + 1e-30);
+        if (s > seam.score) {
+            seam.score = s;
+            seam.best  = seam.first + j;
+        }
+        // slide energy window by one frame
+        for (int c = 0; c < ch; c++) {
+            ea += (double)a[n + c] * a[n + c] - (double)a[c] * a[c];
+        }
+        ea = ea > 0 ? ea : 0;
+    }
+    atomic_store(&seam.done, true);
+    return NULL;
+}
+
+// search loop end near current end on the reference track
+static void fit_seam(void) {
+    struct track* t  = atomic_load(&table)->tracks[0];
+    int           ch = player.channels;
+    int           n  = LATENCY * player.samplerate / 1000;
+    int           r  = SEAM_RANGE * player.samplerate / 1000;
+    int           l  = min(n, player.start); // frames compared before the seam
+
+    if (seam.busy || !t) {
+        return;
+    }
+    seam.start = player.start;
+    seam.end   = player.end;
+    seam.first = max(seam.end - r, seam.start + 2 * n);
+    seam.count = min(seam.end + r, player.length - 1) - seam.first + 1;
+    seam.len   = (l + n) * ch;
+    if (seam.count <= 0) {
+        printf("%-80s\n", "loop too short for seam search");
+        return;
+    }
+
+    // copy regions, the track may be removed while the search runs
+    size_t size = (size_t)(seam.count + l + n) * ch;
+    seam.a = alloc(seam.a, size * sizeof(float));
+    seam.b = alloc(seam.b, (size_t)seam.len * sizeof(float));
+    track_read(t, seam.first - l, seam.count + l + n, seam.a);
+    track_read(t, seam.start - l, l + n, seam.b);
+
+    seam.busy = true;
+    atomic_store(&seam.done, false);
+    seam.thread = spawn(seam_main, NULL);
+}
+
+// apply search result unless the loop was changed meanwhile
+static void poll_seam(void) {
+    char msg[81];
+    if (!seam.busy || !atomic_load(&seam.done)) {
+        return;
+    }
+    join(seam.thread);
+    seam.busy = false;
+    if (player.start != seam.start || player.end != seam.end) {
+        return;
+    }
+    player.end = seam.best;
+    snprintf(msg, sizeof(msg), "loop end moved by %+.1f ms, match %.2f",
+             (seam.best - seam.end) * 1000.0 / player.samplerate, seam.score);
+    printf("%-80s\n", msg);
+}
+
+// difference level of block, the reference shows the largest difference of any track
+static float passage_score(int slot, int b) {
+    float s = NAN;
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        if (i == slot || diff.of[slot] == diff.ref) {
+            float v = atomic_load_explicit(&diff.score[i][b], memory_order_relaxed);
+            s = isnan(s) || v > s ? v : s;
+        }
+    }
+    return s;
+}
+
+// loop next of the most different passages of current track
+static void next_passage(void) {
+    int  size = DIFF_BLOCK * player.samplerate / 1000;
+    int  pick[DIFF_TOP];
+    int  count = 0;
+    char msg[81];
+
+    // best blocks, neighbours of picked blocks belong to the same passage
+    for (; count < DIFF_TOP; count++) {
+        int   best  = -1;
+        float score = 0;
+        for (int b = 0; b < diff.blocks; b++) {
+            float s    = passage_score(player.track, b);
+            bool  near = false;
+            for (int j = 0; j < count; j++) {
+                near |= abs(pick[j] - b) <= 1;
+            }
+            if (!isnan(s) && !near && (best < 0 || s > score)) {
+                best  = b;
+                score = s;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        pick[count] = best;
+    }
+    if (!count) {
+        printf("%-80s\n", "no differences found yet");
+        return;
+    }
+
+    diff.rank = (diff.rank + 1) % count;
+    int b = pick[diff.rank];
+    player.start = max(b * size - size / 2, 0);
+    player.end   = min((b + 1) * size + size / 2, player.length);
+    player.seek  = player.start;
+
+    int sec = b * DIFF_BLOCK / 1000;
+    snprintf(msg, sizeof(msg), "passage %d/%d at %d:%02d, difference %.1f dB",
+             diff.rank + 1, count, sec / 60, sec % 60, passage_score(player.track, b));
+    printf("%-80s\n", msg);
+}
+
+// queue file for background loading
+static void queue_track(char* name) {
+    FILE* f = name ? fopen(name, "rb") : NULL;
+    if (!f) {
+        printf("%s: file not found\n", name ? name : "");
+        return;
+    }
+    fclose(f);
+
+    if (loader.queued < MAX_TRACKS) {
+        loader.queue[loader.queued] = name;
+        loader.queued += 1;
+    }
+}
+
+// start next background load and publish finished tracks
+static void poll_loader(void) {
+    if (loader.busy && atomic_load(&loader.done)) {
+        join(loader.thread);
+        loader.busy = false;
+        if (loader.track.channels) {
+            add_track(loader.track);
+            print_info();
+        }
+    }
+    if (!loader.busy && loader.queued) {
+        loader.name = loader.queue[0];
+        loader.busy = true;
+        loader.queued -= 1;
+        memmove(loader.queue, loader.queue + 1, loader.queued * sizeof(char*));
+        atomic_store(&loader.done, false);
+        loader.thread = spawn(loader_main, NULL);
+    }
+}
+
+// report governor changes
+static void poll_governor(void) {
+    int level = atomic_load(&governor.level);
+    if (level != governor.shown) {
+        printf("%-80s\n", level ? sheds[level - 1].name : "all processing restored");
+        governor.shown = level;
+    }
+}
+
+// update export descriptor with current tracks and loop
+static void poll_export(void) {
+    struct export_head* h = exported;
+    if (!h) {
+        return;
+    }
+
+    struct table* tab = atomic_load(&table);
+    h->sequence += 1;
+    atomic_thread_fence(memory_order_release);
+    h->samplerate = player.samplerate;
+    h->channels   = player.channels;
+    h->length     = player.length;
+    h->track      = player.track;
+    h->pos        = player.pos;
+    h->start      = player.start;
+    h->end        = player.end;
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        const struct track*  t = tab->tracks[i];
+        struct export_track* e = &h->tracks[i];
+        *e = (struct export_track){0};
+        if (!t || !t->shared.base) {
+            continue;
+        }
+        snprintf(e->name, sizeof(e->name), "%s", t->shared.name);
+        if (!arg.blind && !arg.refblind) {
+            snprintf(e->file, sizeof(e->file), "%s", t->name);
+        }
+        e->planar = t->planes.data != NULL;
+        e->frames = padded_length(t);
+        e->offset = e->planar ? PLANE_GUARD * sizeof(float) : 0;
+        e->stride = e->planar ? t->planes.stride * sizeof(float) : 0;
+    }
+    atomic_thread_fence(memory_order_release);
+    h->sequence += 1;
+}
+
+// queue files that appeared in watch directory, once their size is stable
+static void poll_watch(void) {
+#ifndef _WIN32
+    static time_t last;
+    if (!arg.watch_dir || time(NULL) - last < WATCH) {
+        return;
+    }
+    bool first = !last;
+    last = time(NULL);
+
+    DIR* d = opendir(arg.watch_dir);
+    if (!d) {
+        return;
+    }
+
+    struct dirent* de = NULL;
+    while ((de = readdir(d))) {
+        char        path[0x1000] = {0};
+        struct stat st           = {0};
+        snprintf(path, sizeof(path), "%s/%s", arg.watch_dir, de->d_name);
+        if (de->d_name[0] == '.' || stat(path, &st) || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        struct watch* w = NULL;
+        for (int i = 0; i < num_watched && !w; i++) {
+            w = strcmp(watched[i].path, path) ? NULL : &watched[i];
+        }
+        if (!w) {
+            // files present at startup are not added
+            watched = alloc(watched, (num_watched + 1) * sizeof(*w));
+            w       = &watched[num_watched];
+            num_watched += 1;
+            *w = (struct watch){strdup(path), -1, first};
+        }
+
+        // file still being written while size changes
+        if (!w->added && w->size == (long)st.st_size && st.st_size > 0) {
+            w->added = true;
+            queue_track(w->path);
+        }
+        w->size = (long)st.st_size;
+    }
+    closedir(d);
+#endif
+}
+
+// read line from terminal
+static char* read_line(const char* prompt) {
+    char line[0x1000] = {0};
+
+    restore_terminal();
+    printf("%s", prompt);
+    fflush(stdout);
+    char* s = fgets(line, sizeof(line), stdin);
+    init_terminal();
+
+    if (!s) {
+        return NULL;
+    }
+    line[strcspn(line, "\r\n")] = 0;
+    return *line ? strdup(line) : NULL;
+}
+
+// peak resident set size in MB
+static double peak_rss(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage ru = {0};
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1048576.0; // bytes
+#else
+    return ru.ru_maxrss / 1024.0;    // kilobytes
+#endif
+#endif
+}
+
+// callback load percentile from histogram
+static int load_percentile(const unsigned* hist, unsigned total, double p) {
+    unsigned sum = 0;
+    for (int i = 0; i < LOAD_BINS; i++) {
+        sum += hist[i];
+        if (sum > 0 && sum >= p * total) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// names hidden in blind tests until the reveal at exit
+static void print_stats(bool reference, bool blind) {
+    static const char* storage[] = {"heap", "cache", "delta", "dedup", "planar"};
+
+    struct table* tab   = atomic_load(&table);
+    double        total = 0;
+
+    printf("\ntrack                  MB  storage   probe  decode   cache     pad    scan    hash    code   speed\n");
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        struct track* t = tab->tracks[i];
+        if (!t) {
+            continue;
+        }
+        char*  name = t->name + max((int)strlen(t->name) - 16, 0);
+        if (blind) {
+            name = reference && i == 0 ? "reference" : "???";
+        }
+        double mb   = (double)t->length * t->channels * sizeof(float) / 1048576;
+        if (t->delta.ref) {
+            mb = (double)t->delta.size / 1048576;
+        } else if (t->blocks.data) {
+            mb = (double)t->blocks.unique * DEDUP_BLOCK * t->channels * sizeof(float) / 1048576;
+        } else if (t->planes.data) {
+            mb = (double)t->planes.stride * t->channels * sizeof(float) / 1048576;
+        }
+        double dur  = (double)t->length / player.samplerate;
+        double dec  = t->time[STAGE_DECODE];
+        total += mb;
+
+        printf("[%d] %-16.16s %6.1f  %-7s %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f",
+               (i + 1) % 10, name, mb, storage[t->storage], t->time[STAGE_PROBE], dec, t->time[STAGE_CACHE],
+               t->time[STAGE_PAD], t->time[STAGE_SCAN], t->time[STAGE_HASH], t->time[STAGE_CODE]);
+        if (dec > 0) {
+            printf(" %6.0fx\n", dur / dec);
+        } else {
+            printf("       -\n");
+        }
+    }
+
+    unsigned hist[LOAD_BINS] = {0};
+    unsigned calls           = 0;
+    for (int i = 0; i < LOAD_BINS; i++) {
+        hist[i] = atomic_load_explicit(&stats.load_hist[i], memory_order_relaxed);
+        calls += hist[i];
+    }
+
+    printf("decoded %.1f MB, peak rss %.1f MB\n", total, peak_rss());
+    printf("audio init %.3f s, load %.3f s, stream open %.3f s, waited %.3f s for audio\n", stats.init, stats.load,
+           stats.open, stats.wait);
+    printf("callback load p50 %d %%, p90 %d %%, p99 %d %%, max %d %%, %u calls, %u underruns, %u late tails\n",
+           load_percentile(hist, calls, 0.5), load_percentile(hist, calls, 0.9), load_percentile(hist, calls, 0.99),
+           load_percentile(hist, calls, 1.0), calls, atomic_load(&stats.underruns), atomic_load(&stats.late));
+}
+
+// spectral peak pair at anchor frame
+struct print {
+    uint32_t hash; // anchor bin, target bin, frame distance
+    int32_t  time; // anchor frame
+    int32_t  ref;  // reference file, in index only
+};
+
+struct prints {
+    struct print* p;
+    int           count;
+};
+
+// fingerprints of all reference files, sorted by hash
+struct fp_index {
+    struct print* p;
+    int           count;
+    char**        names;
+    int           refs;
+    struct track* tracks; // references decoded for alignment, reused by all items matched to them
+    bool*         tried;  // reference decode attempted, tracks stay empty on failure
+};
+
+static struct fp_index fp_index;
+
+// strongest bin per band, log spaced bands above 90 Hz at 48 kHz
+static const int fp_bands[] = {4, 12, 24, 48, 96, 192, 512};
+#define FP_BANDS ((int)(sizeof(fp_bands) / sizeof(*fp_bands)) - 1)
+
+// hashes of pairs of spectral peaks, robust against coding noise and level changes
+static void fingerprint(const struct track* t, struct prints* out) {
+    int         n      = FP_SIZE;
+    int         frames = t->length >= n ? (t->length - n) / FP_HOP + 1 : 0;
+    struct fft* f      = fft_new(n, false);
+    float*      buf    = alloc(NULL, n * sizeof(float));
+    struct cpx* spec   = alloc(NULL, (n / 2 + 1) * sizeof(struct cpx));
+    int*        peaks  = alloc(NULL, (size_t)max(frames, 1) * FP_BANDS * sizeof(int));
+
+    for (int fr = 0; fr < frames; fr++) {
+        memset(buf, 0, n * sizeof(float));
+        for (int c = 0; c < t->channels; c++) {
+            size_t       step;
+            const float* x = channel(t, c, &step) + (size_t)fr * FP_HOP * step;
+            for (int i = 0; i < n; i++) {
+                buf[i] += x[i * step];
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            buf[i] *= (float)(0.5 - 0.5 * cos(2 * M_PI * i / n));
+        }
+        fft_real(f, buf, spec);
+
+        // keep band maxima above their mean
+        float power[FP_BANDS];
+        float mean = 0;
+        int*  p    = peaks + fr * FP_BANDS;
+        for (int b = 0; b < FP_BANDS; b++) {
+            power[b] = 0;
+            p[b]     = 0;
+            for (int k = fp_bands[b]; k < fp_bands[b + 1]; k++) {
+                float v = spec[k].re * spec[k].re + spec[k].im * spec[k].im;
+                if (v > power[b]) {
+                    power[b] = v;
+                    p[b]     = k;
+                }
+            }
+            mean += power[b] / FP_BANDS;
+        }
+        for (int b = 0; b < FP_BANDS; b++) {
+            p[b] = power[b] >= mean && power[b] > 1e-10f ? p[b] : 0;
+        }
+    }
+
+    // pair every peak with the next peaks within FP_SPAN frames
+    *out = (struct prints){0};
+    out->p = alloc(NULL, (size_t)max(frames, 1) * FP_BANDS * FP_FAN * sizeof(struct print));
+    for (int fr = 0; fr < frames; fr++) {
+        for (int a = 0; a < FP_BANDS; a++) {
+            int k1    = peaks[fr * FP_BANDS + a];
+            int count = 0;
+            for (int d = 1; k1 && d <= FP_SPAN && fr + d < frames && count < FP_FAN; d++) {
+                for (int b = 0; b < FP_BANDS && count < FP_FAN; b++) {
+                    int k2 = peaks[(fr + d) * FP_BANDS + b];
+                    if (k2) {
+                        out->p[out->count++] = (struct print){.hash = (uint32_t)(k1 << 13 | k2 << 4 | d), .time = fr};
+                        count += 1;
+                    }
+                }
+            }
+        }
+    }
+    fft_free(f);
+    free(buf);
+    free(spec);
+    free(peaks);
+}
+
+static int print_cmp(const void* a, const void* b) {
+    const struct print* x = a;
+    const struct print* y = b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return x->ref != y->ref ? (x->ref < y->ref ? -1 : 1) : (x->time > y->time) - (x->time < y->time);
+}
+
+struct fp_job {
+    char*         name;
+    struct prints prints;
+    bool          failed; // not decodable, left out of the index
+};
+
+// fingerprint of reference file, from cache directory if possible
+static void* fp_main(void* ptr) {
+    struct fp_job* job = ptr;
+    char           path[0x1000] = {0};
+    uint64_t       id           = 0;
+    FILE*          f            = NULL;
+
+    bool cached = arg.cache_dir && file_id(job->name, &id);
+    if (cached) {
+        snprintf(path, sizeof(path), "%s/%016llx.fp", arg.cache_dir, (unsigned long long)id);
+        f = fopen(path, "rb");
+    }
+    if (f) {
+        char magic[8] = {0};
+        int  count    = 0;
+        if (fread(magic, 1, 8, f) == 8 && !memcmp(magic, "yuleqf1", 8) && fread(&count, sizeof(count), 1, f) == 1 &&
+            count >= 0) {
+            job->prints.p     = alloc(NULL, max(count, 1) * sizeof(struct print));
+            job->prints.count = (int)fread(job->prints.p, sizeof(struct print), count, f);
+            fclose(f);
+            if (job->prints.count == count) {
+                utimes(path, NULL); // mark as recently used
+                return NULL;
+            }
+            free(job->prints.p);
+        } else {
+            fclose(f);
+        }
+    }
+
+    struct track t = try_load_track(job->name);
+    if (!t.channels) {
+        job->failed = true;
+        return NULL;
+    }
+    fingerprint(&t, &job->prints);
+    free_track(&t);
+
+    char tmp[0x1000] = {0};
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    f       = cached ? cache_create(tmp) : NULL;
+    bool ok = f && fwrite("yuleqf1", 1, 8, f) == 8 && fwrite(&job->prints.count, sizeof(int), 1, f) == 1 &&
+              fwrite(job->prints.p, sizeof(struct print), job->prints.count, f) == (size_t)job->prints.count;
+    if (f) {
+        ok &= fclose(f) == 0;
+    }
+    if (f && (!ok || rename(tmp, path))) {
+        remove(tmp);
+    }
+    return NULL;
+}
+
+static int name_cmp(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// fingerprint all files of reference directory in parallel
+static void build_index(void) {
+#ifndef _WIN32
+    int   batch = cpus();
+    DIR*  d     = opendir(arg.ref_dir);
+    double s    = now();
+    if (!d) {
+        PANIC("can't open reference directory %s\n", arg.ref_dir);
+    }
+    struct dirent* de = NULL;
+    while ((de = readdir(d))) {
+        char        path[0x1000] = {0};
+        struct stat st           = {0};
+        snprintf(path, sizeof(path), "%s/%s", arg.ref_dir, de->d_name);
+        if (de->d_name[0] == '.' || stat(path, &st) || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        fp_index.names = alloc(fp_index.names, (fp_index.refs + 1) * sizeof(char*));
+        fp_index.names[fp_index.refs++] = strdup(path);
+    }
+    closedir(d);
+    if (!fp_index.refs) {
+        PANIC("no reference files in %s\n", arg.ref_dir);
+    }
+    qsort(fp_index.names, fp_index.refs, sizeof(char*), name_cmp);
+
+    struct fp_job* jobs    = alloc(NULL, batch * sizeof(*jobs));
+    int            skipped = 0;
+    for (int i = 0; i < fp_index.refs; i += batch) {
+        int n = min(batch, fp_index.refs - i);
+        memset(jobs, 0, n * sizeof(*jobs));
+        for (int j = 0; j < n; j++) {
+            jobs[j].name = fp_index.names[i + j];
+        }
+        run_jobs(fp_main, jobs, sizeof(*jobs), n);
+        for (int j = 0; j < n; j++) {
+            if (jobs[j].failed) {
+                WARN("%s: skipped\n", jobs[j].name);
+                skipped += 1;
+                continue;
+            }
+            fp_index.p = alloc(fp_index.p, (fp_index.count + jobs[j].prints.count + 1) * sizeof(struct print));
+            for (int k = 0; k < jobs[j].prints.count; k++) {
+                fp_index.p[fp_index.count] = jobs[j].prints.p[k];
+                fp_index.p[fp_index.count++].ref = i + j;
+            }
+            free(jobs[j].prints.p);
+        }
+    }
+    free(jobs);
+    if (skipped == fp_index.refs) {
+        PANIC("no reference files in %s\n", arg.ref_dir);
+    }
+    qsort(fp_index.p, fp_index.count, sizeof(struct print), print_cmp);
+    printf("indexed %d references, %d hashes in %.2f s\n", fp_index.refs - skipped, fp_index.count, now() - s);
+#endif
+}
+
+// count of equal (ref, time) entries from sorted position i
+static int run_length(const struct print* p, int n, int i) {
+    int j = i;
+    while (j < n && p[j].ref == p[i].ref && p[j].time == p[i].time) {
+        j++;
+    }
+    return j - i;
+}
+
+// reference with most hashes at one frame offset, -1 if no reference matches
+static int fp_match(const struct prints* c, int* offset, int* votes) {
+    struct print* hits  = NULL;
+    int           n     = 0;
+    int           best  = -1;
+    int           score = 0;
+
+    for (int i = 0; i < c->count; i++) {
+        // first index entry with hash
+        int lo = 0;
+        int hi = fp_index.count;
+        while (lo < hi) {
+            int m = (lo + hi) / 2;
+            if (fp_index.p[m].hash < c->p[i].hash) {
+                lo = m + 1;
+            } else {
+                hi = m;
+            }
+        }
+        for (hi = lo; hi < fp_index.count && fp_index.p[hi].hash == c->p[i].hash; hi++) {
+        }
+        if (hi - lo > FP_COMMON) {
+            continue;
+        }
+        hits = alloc(hits, (n + hi - lo + 1) * sizeof(*hits));
+        for (int k = lo; k < hi; k++) {
+            hits[n++] = (struct print){.ref = fp_index.p[k].ref, .time = c->p[i].time - fp_index.p[k].time};
+        }
+    }
+
+    // offsets between hop multiples spread over two neighboring frames
+    qsort(hits, n, sizeof(*hits), print_cmp);
+    for (int i = 0; i < n; i += run_length(hits, n, i)) {
+        int v = run_length(hits, n, i);
+        int j = i + v;
+        if (j < n && hits[j].ref == hits[i].ref && hits[j].time == hits[i].time + 1) {
+            v += run_length(hits, n, j);
+        }
+        if (v > score) {
+            score   = v;
+            best    = hits[i].ref;
+            *offset = hits[i].time * FP_HOP;
+        }
+    }
+    free(hits);
+    *votes = score;
+    return score >= FP_VOTES ? best : -1;
+}
+
+// results of one item, stored per content hash
+struct item_result {
+    char     magic[8];  // ANALYSIS
+    uint64_t hash;      // content hash of item
+    double   loudness;  // integrated loudness in LUFS
+    double   true_peak; // true peak in dBTP
+    double   bandwidth; // highest frequency within 60 dB of spectrum peak in Hz
+};
+
+// results of one item against the reference, stored per pair of content hashes
+struct pair_result {
+    char     magic[8];  // ANALYSIS
+    uint64_t ref;       // content hash of reference
+    uint64_t hash;      // content hash of item
+    double   diff;      // difference level in dBFS
+    double   snr;       // reference to difference ratio in dB
+};
+
+struct analysis_job {
+    char*              name;
+    struct track       track;
+    struct item_result item;
+    struct pair_result pair;
+    bool               item_cached;
+    bool               pair_cached;
+    bool               pair_valid;
+    int                match;  // matching reference file in index, -1 if none
+    int                offset; // frames the item is later than its reference
+    int                votes;  // fingerprint hashes found at offset
+};
+
+// read result file, false if missing or written by another version
+static bool result_load(const char* path, void* r, size_t size) {
+    FILE* f  = fopen(path, "rb");
+    bool  ok = f && fread(r, 1, size, f) == size && !memcmp(r, ANALYSIS, sizeof(ANALYSIS));
+    if (f) {
+        fclose(f);
+    }
+    if (ok) {
+        utimes(path, NULL); // mark as recently used
+    }
+    return ok;
+}
+
+static void result_store(const char* path, void* r, size_t size) {
+    char tmp[0x1000] = {0};
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    memcpy(r, ANALYSIS, sizeof(ANALYSIS));
+
+    FILE* f  = cache_create(tmp);
+    bool  ok = f && fwrite(r, 1, size, f) == size;
+    if (f) {
+        ok &= fclose(f) == 0;
+    }
+    if (!ok || rename(tmp, path)) {
+        remove(tmp);
+    }
+}
+
+// biquad in direct form 1, state per channel
+struct biquad {
+    double b[3];
+    double a[3];
+};
+
+// itu-r bs.1770 k-weighting for samplerate
+static void k_weighting(int sr, struct biquad* shelf, struct biquad* hp) {
+    double k  = tan(M_PI * 1681.974450955533 / sr);
+    double q  = 0.7071752369554196;
+    double vh = pow(10, 3.999843853973347 / 20);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+    *shelf = (struct biquad){
+        {(vh + vb * k / q + k * k) / a0, 2 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0},
+        {1, 2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0},
+    };
+
+    k  = tan(M_PI * 38.13547087602444 / sr);
+    q  = 0.5003270373238773;
+    a0 = 1 + k / q + k * k;
+    *hp = (struct biquad){{1, -2, 1}, {1, 2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0}};
+}
+
+// integrated loudness with absolute and relative gating
+static double loudness(const struct track* t) {
+    int ch   = t->channels;
+    int hop  = pcm_rate(t) / 10; // 100 ms, gating blocks are 4 hops
+    int hops = t->length / hop;
+
+    struct biquad f[2];
+    k_weighting(pcm_rate(t), &f[0], &f[1]);
+
+    double* z = alloc(NULL, (size_t)max(hops, 1) * sizeof(double));
+    memset(z, 0, (size_t)max(hops, 1) * sizeof(double));
+    for (int c = 0; c < ch; c++) {
+        double       w = ch >= 6 && c == 3 ? 0 : ch >= 6 && c >= 4 ? 1.41 : 1; // 5.1 lfe and surrounds
+        double       x[2][3] = {{0}};
+        double       y[2][3] = {{0}};
+        size_t       step;
+        const float* pcm = channel(t, c, &step);
+        for (int h = 0; h < hops; h++) {
+            double sum = 0;
+            for (int i = h * hop; i < (h + 1) * hop; i++) {
+                double v = pcm[i * step];
+                for (int s = 0; s < 2; s++) {
+                    x[s][2] = x[s][1];
+                    x[s][1] = x[s][0];
+                    x[s][0] = v;
+                    v = f[s].b[0] * x[s][0] + f[s].b[1] * x[s][1] + f[s].b[2] * x[s][2] - f[s].a[1] * y[s][0] -
+                        f[s].a[2] * y[s][1];
+                    y[s][2] = y[s][1];
+                    y[s][1] = y[s][0];
+                    y[s][0] = v;
+                }
+                sum += v * v;
+            }
+            z[h] += w * sum / hop;
+        }
+    }
+
+    // 400 ms blocks with 75 % overlap
+    double sum[2]   = {0};
+    int    count[2] = {0};
+    for (int pass = 0; pass < 2; pass++) {
+        double gate = pass ? -0.691 + 10 * log10(sum[0] / max(count[0], 1)) - 10 : -70;
+        for (int h = 0; h + 4 <= hops; h++) {
+            double e = (z[h] + z[h + 1] + z[h + 2] + z[h + 3]) / 4;
+            if (-0.691 + 10 * log10(e + 1e-20) > gate) {
+                sum[pass] += e;
+                count[pass] += 1;
+            }
+        }
+    }
+    free(z);
+    return count[1] ? -0.691 + 10 * log10(sum[1] / count[1]) : -INFINITY;
+}
+
+// highest frequency of average spectrum within 60 dB of its peak
+static double bandwidth(const struct track* t) {
+    int         n    = SPEC_SIZE;
+    int         ch   = t->channels;
+    struct fft* f    = fft_new(n, false);
+    float*      buf  = alloc(NULL, n * sizeof(float));
+    struct cpx* spec = alloc(NULL, (n / 2 + 1) * sizeof(struct cpx));
+    double*     pow  = alloc(NULL, (n / 2 + 1) * sizeof(double));
+    memset(pow, 0, (n / 2 + 1) * sizeof(double));
+
+    for (int p = 0; p + n <= t->length; p += n) {
+        memset(buf, 0, n * sizeof(float));
+        for (int c = 0; c < ch; c++) {
+            size_t       step;
+            const float* x = channel(t, c, &step) + p * step;
+            for (int i = 0; i < n; i++) {
+                buf[i] += x[i * step];
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            buf[i] *= (float)(0.5 - 0.5 * cos(2 * M_PI * i / n));
+        }
+        fft_real(f, buf, spec);
+        for (int k = 0; k <= n / 2; k++) {
+            pow[k] += (double)spec[k].re * spec[k].re + (double)spec[k].im * spec[k].im;
+        }
+    }
+
+    double peak = 0;
+    int    top  = 0;
+    for (int k = 1; k <= n / 2; k++) {
+        peak = pow[k] > peak ? pow[k] : peak;
+    }
+    for (int k = 1; k <= n / 2; k++) {
+        top = pow[k] > peak * 1e-6 ? k : top;
+    }
+    fft_free(f);
+    free(buf);
+    free(spec);
+    free(pow);
+    return (double)top * pcm_rate(t) / n;
+}
+
+static void* analysis_main(void* ptr) {
+    struct analysis_job* job = ptr;
+    struct track*        t   = &job->track;
+    char                 path[0x1000] = {0};
+
+    // a file that can't be decoded is reported in its row, the others are still analyzed
+    *t = try_load_track(job->name);
+    if (!t->channels) {
+        return NULL;
+    }
+    if (arg.storage == STORAGE_PLANAR) {
+        planar_track(t, t->length);
+    }
+
+    snprintf(path, sizeof(path), "%s/%016llx.res", arg.cache_dir, (unsigned long long)t->hash);
+    job->item_cached = arg.cache_dir && result_load(path, &job->item, sizeof(job->item)) && job->item.hash == t->hash;
+    if (!job->item_cached) {
+        job->item = (struct item_result){
+            .hash      = t->hash,
+            .loudness  = loudness(t),
+            .true_peak = 20 * log10(t->scan.true_peak + 1e-20),
+            .bandwidth = bandwidth(t),
+        };
+        if (arg.cache_dir) {
+            result_store(path, &job->item, sizeof(job->item));
+        }
+    }
+    return NULL;
+}
+
+// difference of job track against reference, from result cache if possible
+static void analyze_pair(struct analysis_job* job, const struct track* ref) {
+    const struct track* t = &job->track;
+    char                path[0x1000] = {0};
+
+    job->pair_valid = t->channels && t->channels == ref->channels;
+    if (!job->pair_valid) {
+        return;
+    }
+    int n = snprintf(path, sizeof(path), "%s/%016llx-%016llx", arg.cache_dir, (unsigned long long)ref->hash,
+                     (unsigned long long)t->hash);
+    snprintf(path + n, sizeof(path) - n, job->offset ? "%+d.pair" : ".pair", job->offset);
+    job->pair_cached = arg.cache_dir && result_load(path, &job->pair, sizeof(job->pair)) &&
+                       job->pair.ref == ref->hash && job->pair.hash == t->hash;
+    if (job->pair_cached) {
+        return;
+    }
+
+    // sum in blocks, float sums lose precision over long tracks
+    int    ch    = t->channels;
+    int    o     = job->offset;
+    int    from  = max(-o, 0);
+    int    to    = min(ref->length, t->length - o);
+    int    len   = max(to - from, 0);
+    int    size  = DIFF_BLOCK * pcm_rate(t) / 1000;
+    double diff  = 0;
+    double power = 0;
+    for (int p = from; p < to; p += size) {
+        int n = min(size, to - p) * ch;
+        if (t->planes.data && ref->planes.data) {
+            // channel by channel, each plane is contiguous
+            for (int c = 0; c < ch; c++) {
+                const float* a = ref->planes.data + c * ref->planes.stride + p;
+                const float* b = t->planes.data + c * t->planes.stride + p + o;
+                diff  += diff_energy(a, b, n / ch, 1, 0) * (n / ch);
+                power += (double)dot(a, a, n / ch);
+            }
+            continue;
+        }
+        diff  += diff_energy(ref->pcm + (size_t)p * ch, t->pcm + (size_t)(p + o) * ch, n, ch, 0) * n;
+        power += (double)dot(ref->pcm + (size_t)p * ch, ref->pcm + (size_t)p * ch, n);
+    }
+    job->pair = (struct pair_result){
+        .ref  = ref->hash,
+        .hash = t->hash,
+        .diff = 10 * log10(diff / max(len * ch, 1) + 1e-20),
+        .snr  = 10 * log10((power + 1e-20) / (diff + 1e-20)),
+    };
+    if (arg.cache_dir) {
+        result_store(path, &job->pair, sizeof(job->pair));
+    }
+}
 
-    t.channels   = grep_int(b.buf, "streams.stream.0.channels=");
-    t.samplerate = grep_int(b.buf, "streams.stream.0.sample_rate=\"");
-    if (t.channels == 0 || t.samplerate == 0) {
-        PANIC("%s: invalid audio file\n", name);
+// print one row of the analysis table
+static void analysis_row(const struct analysis_job* job, bool pair) {
+    char* name   = job->name + max((int)strlen(job->name) - 32, 0);
+    bool  cached = job->item_cached && (!pair || !job->pair_valid || job->pair_cached);
+    if (!job->track.channels) {
+        printf("%-32.32s can't be decoded\n", name);
+        return;
+    }
+    printf("%-32.32s %016llx %7.1f %7.1f %7.1f", name, (unsigned long long)job->item.hash, job->item.loudness,
+           job->item.true_peak, job->item.bandwidth / 1000);
+    if (pair && job->pair_valid) {
+        printf(" %8.1f %8.1f", job->pair.diff, job->pair.snr);
+    } else {
+        printf("        -        -");
     }
+    if (arg.ref_dir && job->match >= 0) {
+        printf(" %+9.1f  %s", job->offset * 1000.0 / pcm_rate(&job->track), fp_index.names[job->match]);
+    } else if (arg.ref_dir) {
+        printf("         -  no reference found");
+    }
+    printf("%s\n", cached ? "  *" : "");
+}
 
-    int duration = grep_int(b.buf, "streams.stream.0.duration=\"");
-    if (duration > MAX_LENGTH) {
-        PANIC("%s: too long\n", name);
+// analyze file and find its reference by fingerprint
+static void* match_main(void* ptr) {
+    struct analysis_job* job = ptr;
+    struct prints        p   = {0};
+
+    analysis_main(job);
+    if (!job->track.channels) {
+        job->match = -1;
+        return NULL;
     }
-    free(b.buf);
+    fingerprint(&job->track, &p);
+    job->match = fp_match(&p, &job->offset, &job->votes);
+    free(p.p);
+    if (job->match < 0) {
+        job->offset = 0;
+    }
+    return NULL;
+}
 
-    // get pcm data from ffmpeg
-    char* en = isbig() ? "be" : "le";
-    int   sr = arg.device_rate;
-    if (sr) {
-        b = slurp("ffmpeg -i \"%s\" -af aresample=%d:resampler=soxr:precision=33 -f f32%s -", name, sr, en);
-    } else {
-        b = slurp("ffmpeg -i \"%s\" -f f32%s -", name, en);
+struct ref_job {
+    int ref;
+};
+
+static void* ref_main(void* ptr) {
+    struct ref_job* job = ptr;
+    struct track*   t   = &fp_index.tracks[job->ref];
+
+    *t = try_load_track(fp_index.names[job->ref]);
+    if (t->channels && arg.storage == STORAGE_PLANAR) {
+        planar_track(t, t->length);
     }
+    return NULL;
+}
 
-    t.length = b.size / sizeof(float) / t.channels;
-    t.pcm    = b.buf;
-    t.name   = name;
-    return t;
+// decode references matched in this batch that are not loaded yet, each only once
+static void load_refs(const struct analysis_job* jobs, int n) {
+    struct ref_job* work  = alloc(NULL, max(n, 1) * sizeof(*work));
+    int             count = 0;
+
+    if (!fp_index.tracks) {
+        fp_index.tracks = alloc(NULL, fp_index.refs * sizeof(struct track));
+        fp_index.tried  = alloc(NULL, fp_index.refs * sizeof(bool));
+        memset(fp_index.tracks, 0, fp_index.refs * sizeof(struct track));
+        memset(fp_index.tried, 0, fp_index.refs * sizeof(bool));
+    }
+    for (int i = 0; i < n; i++) {
+        int r = jobs[i].match;
+        if (r >= 0 && !fp_index.tried[r]) {
+            fp_index.tried[r] = true;
+            work[count++].ref = r;
+        }
+    }
+    if (count) {
+        run_jobs(ref_main, work, sizeof(*work), count);
+    }
+    free(work);
 }
 
-static void load_tracks(void) {
+// offset against the matched reference measured to the sample, then compared with it
+static void* align_main(void* ptr) {
+    struct analysis_job* job = ptr;
+    if (job->match < 0) {
+        return NULL;
+    }
+
+    const struct track* ref = &fp_index.tracks[job->match];
+    if (ref->channels) {
+        struct delay_job d = {.ref = ref, .t = &job->track, .shift = job->offset};
+        // middle of the overlap in reference frames, item frame is reference frame + offset
+        d.center = (max(-job->offset, 0) + min(ref->length, job->track.length - job->offset)) / 2;
+        delay_main(&d);
+        if (d.weight > 0) {
+            job->offset += (int)lround(d.delay);
+        }
+    }
+    analyze_pair(job, ref);
+    return NULL;
+}
+
+// analyze all files against the first in batches of parallel jobs, reusing stored results
+static void analyze(void) {
+    int                  batch  = cpus();
+    struct analysis_job* jobs   = alloc(NULL, batch * sizeof(*jobs));
+    struct analysis_job  ref    = {.name = arg.files[0]};
+    int                  done   = 0;
+    int                  reused = 0;
+    double               s      = now();
+
     if (arg.num_files == 0) {
         PANIC("no input files\n");
     }
-    struct player* p  = &player;
-    struct track*  t0 = &tracks[0];
+#ifndef _WIN32
+    if (arg.cache_dir) {
+        mkdir(arg.cache_dir, 0777);
+    }
+#endif
 
-    for (int i = 0; i < arg.num_files; i++) {
-        struct track* t = &tracks[i];
+    // reference stays loaded for all batches, or every file is paired with one from the reference directory
+    if (arg.ref_dir) {
+        build_index();
+        printf("item                             hash                 LUFS    dBTP  bw kHz  diff dB   SNR dB offset ms  reference\n");
+    } else {
+        analysis_main(&ref);
+        done   += ref.track.channels && !ref.item_cached;
+        reused += ref.item_cached;
+        printf("item                             hash                 LUFS    dBTP  bw kHz  diff dB   SNR dB\n");
+        analysis_row(&ref, false);
+    }
 
-        *t = load_track(arg.files[i]);
+    for (int i = !arg.ref_dir; i < arg.num_files; i += batch) {
+        int n = min(batch, arg.num_files - i);
+        memset(jobs, 0, n * sizeof(*jobs));
+        for (int j = 0; j < n; j++) {
+            jobs[j].name = arg.files[i + j];
+        }
+        run_jobs(arg.ref_dir ? match_main : analysis_main, jobs, sizeof(*jobs), n);
+        if (arg.ref_dir) {
+            load_refs(jobs, n);
+            run_jobs(align_main, jobs, sizeof(*jobs), n);
+        }
 
-        // first track determines length, channels, rate
-        if (t->length != t0->length) {
-            printf("%s: length mismatch, got %d, expected %d\n", t->name, t->length, t0->length);
+        for (int j = 0; j < n; j++) {
+            if (!arg.ref_dir) {
+                analyze_pair(&jobs[j], &ref.track);
+            }
+            done   += (jobs[j].track.channels && !jobs[j].item_cached) + (jobs[j].pair_valid && !jobs[j].pair_cached);
+            reused += jobs[j].item_cached + jobs[j].pair_cached;
+            analysis_row(&jobs[j], true);
+            free_track(&jobs[j].track);
         }
-        if (t->channels != t0->channels) {
-            PANIC("%s: channel mismatch, got %d, expected %d\n", t->name, t->channels, t0->channels);
+    }
+    printf("%d results computed, %d reused (*) in %.2f s\n", done, reused, now() - s);
+    free_track(&ref.track);
+    for (int i = 0; fp_index.tracks && i < fp_index.refs; i++) {
+        free_track(&fp_index.tracks[i]);
+    }
+    free(jobs);
+}
+
+// all pairs of tracks compared block by block, every block is read once for all pairs
+struct matrix {
+    struct analysis_job* jobs;
+    int                  count;
+    int                  length; // frames compared, shortest valid track
+    int                  channels; // first decoded track, others with different channels are left out
+    int                  blocks;
+    atomic_int           next;   // next block
+};
+
+struct matrix_job {
+    struct matrix* m;
+    double*        diff; // difference energy sums of all pairs, count * count
+};
+
+static void* matrix_main(void* ptr) {
+    struct matrix_job* job = ptr;
+    struct matrix*     m   = job->m;
+    int                ch  = m->channels;
+    float*             buf = alloc(NULL, (size_t)m->count * MATRIX_BLOCK * ch * sizeof(float));
+    const float**      x   = alloc(NULL, m->count * sizeof(float*));
+
+    for (int b; (b = atomic_fetch_add(&m->next, 1)) < m->blocks;) {
+        int from = b * MATRIX_BLOCK;
+        int n    = min(MATRIX_BLOCK, m->length - from);
+        for (int i = 0; i < m->count; i++) {
+            const struct track* t = &m->jobs[i].track;
+            x[i] = t->channels == ch ? track_span(t, from, n, buf + (size_t)i * MATRIX_BLOCK * ch) : NULL;
         }
-        if (t->samplerate != t0->samplerate) {
-            PANIC("%s: samplerate mismatch, got %d, expected %d\n", t->name, t->samplerate, t0->samplerate);
+        for (int i = 0; i < m->count; i++) {
+            for (int j = i + 1; j < m->count && x[i]; j++) {
+                if (x[j]) {
+                    job->diff[i * m->count + j] += diff_energy(x[i], x[j], n * ch, ch, 0) * n * ch;
+                }
+            }
+        }
+    }
+    free(buf);
+    free(x);
+    return NULL;
+}
+
+// difference of every file against every other file as matrix
+static void analyze_matrix(void) {
+    int                  batch = cpus();
+    int                  count = arg.num_files;
+    struct analysis_job* jobs  = alloc(NULL, max(count, 1) * sizeof(*jobs));
+    struct matrix_job*   work  = alloc(NULL, batch * sizeof(*work));
+    double*              diff  = alloc(NULL, (size_t)max(count, 1) * max(count, 1) * sizeof(double));
+    struct matrix        m     = {.jobs = jobs, .count = count};
+    double               s     = now();
+
+    if (count == 0) {
+        PANIC("no input files\n");
+    }
+#ifndef _WIN32
+    if (arg.cache_dir) {
+        mkdir(arg.cache_dir, 0777);
+    }
+#endif
+
+    // all files stay loaded, blocks of all files are compared together
+    memset(jobs, 0, count * sizeof(*jobs));
+    for (int i = 0; i < count; i += batch) {
+        for (int j = i; j < count && j < i + batch; j++) {
+            jobs[j].name = arg.files[j];
+        }
+        run_jobs(analysis_main, jobs + i, sizeof(*jobs), min(batch, count - i));
+    }
+    int base = 0;
+    while (base < count - 1 && !jobs[base].track.channels) {
+        base += 1;
+    }
+    m.channels = jobs[base].track.channels;
+    m.length   = jobs[base].track.length;
+    for (int i = base + 1; i < count; i++) {
+        if (jobs[i].track.channels == m.channels) {
+            m.length = min(m.length, jobs[i].track.length);
         }
+    }
+    m.blocks = (m.length + MATRIX_BLOCK - 1) / MATRIX_BLOCK;
 
-        if (i == 0) {
-            p->length     = t->length;
-            p->channels   = t->channels;
-            p->samplerate = arg.device_rate ? arg.device_rate : t->samplerate;
+    memset(diff, 0, (size_t)count * count * sizeof(double));
+    for (int i = 0; i < batch; i++) {
+        work[i].m    = &m;
+        work[i].diff = alloc(NULL, (size_t)count * count * sizeof(double));
+        memset(work[i].diff, 0, (size_t)count * count * sizeof(double));
+    }
+    run_jobs(matrix_main, work, sizeof(*work), batch);
+    for (int i = 0; i < batch; i++) {
+        for (int k = 0; k < count * count; k++) {
+            diff[k] += work[i].diff[k];
         }
+        free(work[i].diff);
+    }
 
-        // apply zero padding to end of buffer
-        int samples = LATENCY * player.samplerate / 1000;
-        if (t->length < p->length) {
-            samples += p->length - t->length;
+    printf("    item                             hash                 LUFS    dBTP  bw kHz\n");
+    for (int i = 0; i < count; i++) {
+        const struct analysis_job* job = &jobs[i];
+        if (!job->track.channels) {
+            printf("%3d %-32.32s can't be decoded\n", i + 1, job->name + max((int)strlen(job->name) - 32, 0));
+            continue;
+        }
+        printf("%3d %-32.32s %016llx %7.1f %7.1f %7.1f%s\n", i + 1, job->name + max((int)strlen(job->name) - 32, 0),
+               (unsigned long long)job->item.hash, job->item.loudness, job->item.true_peak, job->item.bandwidth / 1000,
+               job->item_cached ? "  *" : "");
+    }
+    printf("\ndifference in dB over %.1f s\n    ", (double)m.length / max(pcm_rate(&jobs[base].track), 1));
+    for (int j = 0; j < count; j++) {
+        printf(" %6d", j + 1);
+    }
+    for (int i = 0; i < count; i++) {
+        printf("\n%3d ", i + 1);
+        for (int j = 0; j < count; j++) {
+            double d = diff[min(i, j) * count + max(i, j)];
+            bool   v = m.channels && jobs[i].track.channels == m.channels && jobs[j].track.channels == m.channels;
+            if (i == j || !v) {
+                printf("      -");
+            } else {
+                printf(" %6.1f", 10 * log10(d / ((double)m.length * m.channels) + 1e-20));
+            }
         }
-        int size  = t->length * t->channels * sizeof(float);
-        int bytes = samples * t->channels * sizeof(float);
-        t->pcm = alloc(t->pcm, size + bytes);
-        memset(t->pcm + t->length * t->channels, 0, bytes);
     }
+    printf("\n%d files in %.2f s\n", count, now() - s);
+
+    for (int i = 0; i < count; i++) {
+        free_track(&jobs[i].track);
+    }
+    free(jobs);
+    free(work);
+    free(diff);
 }
 
-static void shuffle_tracks(bool skip_first) {
-    srand((unsigned)time(NULL));
-    int n = arg.num_files;
+// handle ctrl-c
+static void signal_handler(int sig) {
+    player.running = false;
+}
 
-    for (int i = (int)skip_first; i < n - 1; i++) {
-        int j = i + (int)(rand() / (RAND_MAX + 1.0) * (n - i));
-        struct track t = tracks[i];
-        tracks[i] = tracks[j];
-        tracks[j] = t;
+#ifndef _WIN32
+
+// file decoded by daemon
+struct daemon_entry {
+    char*    name;  // source file
+    uint64_t id;    // file identity
+    uint64_t hash;  // content hash, names the shared memory objects
+    size_t   size;  // shared memory size in bytes
+    double   used;  // last request time
+    bool     ready; // false while decoding
+};
+
+struct daemon {
+    struct daemon_entry* entries;
+    int                  count;
+    size_t               total;   // shared memory in use in bytes
+    int                  serving; // requests in flight
+    pthread_mutex_t      lock;
+    pthread_cond_t       idle;    // signaled when a request is done
+};
+
+static struct daemon daemon_state = {.lock = PTHREAD_MUTEX_INITIALIZER, .idle = PTHREAD_COND_INITIALIZER};
+
+static bool shared_hash(uint64_t hash, int skip) {
+    for (int i = 0; i < daemon_state.count; i++) {
+        if (i != skip && daemon_state.entries[i].ready && daemon_state.entries[i].hash == hash) {
+            return true;
+        }
     }
+    return false;
 }
 
-#ifdef _WIN32
+// remove entry, shared memory is freed once no client maps it anymore
+static void daemon_remove(int i) {
+    struct daemon_entry* e = &daemon_state.entries[i];
+    char                 shm[64] = {0};
 
-static void init_terminal(void) {
-    DWORD m = 0;
-    GetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), &m);
-    m &= ~(ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT | ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT);
-    SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), m);
-    GetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), &m);
-    m |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
-    SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), m);
-    write(1, "\33[?25l", 6); // hide cursor
+    if (e->ready && !shared_hash(e->hash, i)) {
+        daemon_shm(e->hash, shm, sizeof(shm));
+        shm_unlink(shm);
+        daemon_state.total -= e->size;
+        printf("evicted %s\n", e->name);
+    }
+    free(e->name);
+    *e = daemon_state.entries[--daemon_state.count];
 }
 
-static void restore_terminal(void) {
-    DWORD m = 0;
-    GetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), &m);
-    m |= ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT;
-    SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), m);
-    write(1, "\33[?25h\n", 7); // show cursor
-    GetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), &m);
-    m &= ~ENABLE_VIRTUAL_TERMINAL_PROCESSING;
-    SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), m);
+// remove least recently used entries above cache limit, lock held
+static void daemon_evict(void) {
+    size_t limit = (size_t)arg.cache_size << 20;
+    while (daemon_state.total > limit) {
+        int lru = -1;
+        for (int i = 0; i < daemon_state.count; i++) {
+            struct daemon_entry* e = &daemon_state.entries[i];
+            if (e->ready && (lru < 0 || e->used < daemon_state.entries[lru].used)) {
+                lru = i;
+            }
+        }
+        if (lru < 0) {
+            break;
+        }
+        daemon_remove(lru);
+    }
 }
 
-static char read_key(void) {
-    HANDLE h = GetStdHandle(STD_INPUT_HANDLE);
-    if (WaitForSingleObject(h, 100) == WAIT_TIMEOUT) {
-        return 0;
+// decode in the serving thread into shared memory, a broken file leaves an empty track and no entry
+static bool daemon_decode(char* name, uint64_t* hash, size_t* size) {
+    struct track t = try_load_track(name);
+    if (!t.channels) {
+        return false;
     }
-    DWORD        n    = 0;
-    INPUT_RECORD r[1] = {0};
-    ReadConsoleInput(h, r, 1, &n);
-    if (r[0].EventType != KEY_EVENT || !r[0].Event.KeyEvent.bKeyDown) {
-        return 0;
+
+    // same layout as cache entry
+    char   shm[64] = {0};
+    size_t pcm     = (size_t)t.length * t.channels * sizeof(float);
+    daemon_shm(t.hash, shm, sizeof(shm));
+    char* m = shm_create(shm, CACHE_HEAD + pcm);
+    if (m) {
+        cache_head(&t, m);
+        memcpy(m + CACHE_HEAD, t.pcm, pcm);
+        munmap(m, CACHE_HEAD + pcm);
     }
-    return r[0].Event.KeyEvent.uChar.AsciiChar;
+    *hash = t.hash;
+    *size = CACHE_HEAD + pcm;
+    free_track(&t);
+    return m != NULL;
 }
 
-#else // _WIN32
+// content hash of file, decoded once, concurrent requests for the same file wait
+static bool daemon_get(char* name, uint64_t* hash) {
+    uint64_t id = 0;
+    if (!file_id(name, &id)) {
+        return false;
+    }
 
-static void init_terminal(void) {
-    struct termios a = { 0 };
-    tcgetattr(0, &a);
-    a.c_lflag &= ~(ICANON | ECHO); // unbuffered, echo off
-    a.c_cc[VMIN]  = 0;             // 100 ms read timeout
-    a.c_cc[VTIME] = 1;
-    tcsetattr(0, TCSANOW, &a);
-    write(1, "\33[?25l", 6); // hide cursor
-}
+    pthread_mutex_lock(&daemon_state.lock);
+    for (int i = 0; i < daemon_state.count; i++) {
+        struct daemon_entry* e = &daemon_state.entries[i];
+        if (e->id != id) {
+            continue;
+        }
+        if (!e->ready) {
+            pthread_mutex_unlock(&daemon_state.lock);
+            usleep(10000);
+            pthread_mutex_lock(&daemon_state.lock);
+            i = -1; // entries may have moved
+            continue;
+        }
+        e->used = now();
+        *hash   = e->hash;
+        pthread_mutex_unlock(&daemon_state.lock);
+        return true;
+    }
+    daemon_state.entries = alloc(daemon_state.entries, (daemon_state.count + 1) * sizeof(struct daemon_entry));
+    daemon_state.entries[daemon_state.count++] = (struct daemon_entry){.name = strdup(name), .id = id};
+    pthread_mutex_unlock(&daemon_state.lock);
 
-static void restore_terminal(void) {
-    struct termios a = { 0 };
-    tcgetattr(0, &a);
-    a.c_lflag |= (ICANON | ECHO); // buffered, echo on
-    tcsetattr(0, TCSANOW, &a);
-    write(1, "\33[?25h\n", 7); // display cursor
-}
+    double s    = now();
+    size_t size = 0;
+    bool   ok   = daemon_decode(name, hash, &size);
 
-static char read_key(void) {
-    char ch = 0;
-    read(0, &ch, 1);
-    return ch;
+    pthread_mutex_lock(&daemon_state.lock);
+    for (int i = 0; i < daemon_state.count; i++) {
+        struct daemon_entry* e = &daemon_state.entries[i];
+        if (e->id == id && !e->ready) {
+            if (!ok) {
+                daemon_remove(i);
+                break;
+            }
+            if (!shared_hash(*hash, i)) {
+                daemon_state.total += size;
+            }
+            e->hash  = *hash;
+            e->size  = size;
+            e->used  = now();
+            e->ready = true;
+            printf("loaded %s, %.1f MB in %.3f s\n", name, size / 1048576.0, now() - s);
+            daemon_evict();
+            break;
+        }
+    }
+    pthread_mutex_unlock(&daemon_state.lock);
+    return ok;
 }
 
-#endif // _WIN32
+// answer one request: "rate path" -> content hash or "-" and error
+static void* serve_main(void* ptr) {
+    int      fd   = (int)(intptr_t)ptr;
+    char     req[0x1000]   = {0};
+    char     reply[0x1100] = {0};
+    char*    name = NULL;
+    uint64_t hash = 0;
+    int      rate = 0;
 
-static void clear_terminal(void) {
-    write(1, "\33[H\33[J", 6);
+    if (!read_request(fd, req, sizeof(req)) || (rate = (int)strtol(req, &name, 10), *name != ' ')) {
+        snprintf(reply, sizeof(reply), "-invalid request\n");
+    } else if (rate != arg.device_rate) {
+        snprintf(reply, sizeof(reply), "-output samplerate %d, daemon runs with %d\n", rate, arg.device_rate);
+    } else if (!daemon_get(name + 1, &hash)) {
+        snprintf(reply, sizeof(reply), "-can't decode %s\n", name + 1);
+    } else {
+        snprintf(reply, sizeof(reply), "%016llx\n", (unsigned long long)hash);
+    }
+    write_all(fd, reply, strlen(reply));
+    close(fd);
+
+    pthread_mutex_lock(&daemon_state.lock);
+    daemon_state.serving -= 1;
+    pthread_cond_signal(&daemon_state.idle);
+    pthread_mutex_unlock(&daemon_state.lock);
+    return NULL;
 }
 
-static void print_progress(void) {
-    char buf[81];
+// serve decoded files to clients until ctrl-c, then free all shared memory
+static void run_daemon(void) {
+    struct sockaddr_un a = {.sun_family = AF_UNIX};
+    daemon_path(a.sun_path, sizeof(a.sun_path));
 
-    int pos   = player.pos * 80 / player.length;
-    int start = player.start * 80 / player.length;
-    int end   = (player.end - 1) * 80 / player.length;
+    int fd = daemon_connect();
+    if (fd >= 0) {
+        PANIC("daemon already running on %s\n", a.sun_path);
+    }
+    unlink(a.sun_path); // stale socket of a killed daemon
 
-    for (int i = 0; i < 80; i++) {
-        if (i == pos) {
-            buf[i] = '0' + (player.track + 1) % 10;
-        } else if (i == start) {
-            buf[i] = '[';
-        } else if (i == end) {
-            buf[i] = ']';
-        } else {
-            buf[i] = '-';
+    umask(077);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&a, sizeof(a)) || listen(fd, MAX_TRACKS)) {
+        PANIC("can't listen on %s\n", a.sun_path);
+    }
+
+    // no restart, so accept returns on ctrl-c
+    struct sigaction sa = {.sa_handler = signal_handler};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    arg.cache_size = arg.cache_size ? arg.cache_size : CACHE_SIZE;
+    printf("daemon listening on %s, limit %d MB\n", a.sun_path, arg.cache_size);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    player.running = true;
+    while (player.running) {
+        int c = accept(fd, NULL, NULL);
+        if (c >= 0) {
+            // a client that never sends its request can't hold up shutdown
+            struct timeval tv = {.tv_sec = DAEMON_READ};
+            setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            pthread_mutex_lock(&daemon_state.lock);
+            daemon_state.serving += 1;
+            pthread_mutex_unlock(&daemon_state.lock);
+            pthread_detach(spawn(serve_main, (void*)(intptr_t)c));
         }
     }
-    buf[80]='\r';
 
-    write(1, buf, 81);
-}
+    close(fd);
+    unlink(a.sun_path);
 
-static void print_files(bool reference, bool blind) {
-    if (reference) {
-        printf("[1] reference\n");
+    // decodes still running would create shared memory after the cleanup
+    pthread_mutex_lock(&daemon_state.lock);
+    if (daemon_state.serving) {
+        printf("waiting for %d requests\n", daemon_state.serving);
     }
-    for (int i = (int)reference; i < arg.num_files; i++) {
-        char* name = blind ? "???" : tracks[i].name;
-        printf("[%d] %s\n", (i + 1) % 10, name);
+    while (daemon_state.serving) {
+        pthread_cond_wait(&daemon_state.idle, &daemon_state.lock);
     }
+    while (daemon_state.count) {
+        daemon_remove(0);
+    }
+    pthread_mutex_unlock(&daemon_state.lock);
 }
 
-static void print_info(void) {
-    printf("--------------------------------------------------------------------------------\n");
-    print_files(arg.refblind, arg.blind || arg.refblind);
-    printf("--------------------------------------------------------------------------------\n"
-           "[s] start  [x] clear  [i/o] adjust  [q]     quit                     %d channels\n"
-           "[d] end    [c] clear  [k/l] adjust  [space] pause                    %d Hz\n",
-           player.channels, player.samplerate);
-}
-
-// handle ctrl-c
-static void signal_handler(int sig) {
-    player.running = false;
-}
+#endif // _WIN32
 
 int main(int argc, char** argv) {
     parse_args(argc - 1, argv + 1);
     if (!arg.verbose) {
         fclose(stderr); // mute portaudio / ffmpeg print noise
     }
+    if (arg.analyze) {
+        if (arg.matrix) {
+            analyze_matrix();
+        } else {
+            analyze();
+        }
+        return 0;
+    }
+#ifndef _WIN32
+    if (arg.daemon) {
+        run_daemon();
+        return 0;
+    }
+#endif
 
-    init_audio();
     if (arg.list_devices) {
+        init_audio();
         list_devices();
         exit(0);
     }
+#ifndef _WIN32
+    if (arg.export) {
+        start_export();
+    }
+#endif
+    audio.thread = spawn(audio_main, NULL);
 
+    double s = now();
     load_tracks();
     if (arg.blind || arg.refblind) {
         shuffle_tracks(arg.refblind);
     }
+#ifndef _WIN32
+    // after shuffle, export follows slot order
+    for (int i = 0; i < arg.num_files && arg.export; i++) {
+        export_track(atomic_load(&table)->tracks[i], i);
+    }
+#endif
+    if (arg.hrir) {
+        load_hrir();
+    }
+    if (arg.filter) {
+        load_filter();
+    }
 
+    stats.load = now() - s;
+
+    start_diff();
     gen_window();
+    s = now();
+    join(audio.thread);
+    stats.wait = now() - s;
+    if (atomic_load(&audio.outputs) != player.outputs || atomic_load(&audio.samplerate) != player.samplerate) {
+        PANIC("stream format mismatch\n");
+    }
     start_stream();
 
     init_terminal();
-    if (!arg.verbose) {
+    if (!arg.verbose && !warnings) {
         clear_terminal();
     }
+    poll_export();
     print_info();
     signal(SIGINT, signal_handler);
 
-    int step = STEP * player.samplerate / 1000;
+    int  step = STEP * player.samplerate / 1000;
+    char mark = 0; // pending bookmark command
 
     while (player.running) {
         char ch = read_key(); // key or 0 on timeout
 
+        // bookmark commands take a digit, other keys cancel
+        if (mark && ch) {
+            if (ch >= '0' && ch <= '9') {
+                use_bookmark(mark, ch - '0');
+            }
+            mark = 0;
+            ch   = 0;
+        }
+
         switch (ch) {
         case ' ':
             player.paused = !player.paused;
@@ -609,16 +5382,30 @@ int main(int argc, char** argv) {
         case '7':
         case '8':
         case '9':
-            if (ch - '0' <= arg.num_files) {
-                player.next = ch - '0' - 1;
+            if (atomic_load(&table)->tracks[ch - '0' - 1]) {
+                if (events.cycle) {
+                    events.cycle = false;
+                    flush_events();
+                }
+                post_event((struct event){.track = ch - '0' - 1});
             }
             break;
+        case 'a': // add track
+            queue_track(read_line("file: "));
+            print_info();
+            break;
         case 'c': // clear end
             player.end = player.length;
             break;
         case 'd': // set end
             player.end = player.pos;
             break;
+        case 'e': // smooth loop seam
+            fit_seam();
+            break;
+        case 'n': // next different passage
+            next_passage();
+            break;
         case 'i': // dec start
             player.start = max(player.start - step, 0);
             break;
@@ -631,17 +5418,39 @@ int main(int argc, char** argv) {
         case 'o': // inc start
             player.start = min(player.start + step, player.end);
             break;
+        case 'm': // store bookmark
+        case '\'': // recall bookmark
+            mark = ch;
+            break;
+        case 'r': // remove track
+            remove_track(player.track);
+            print_info();
+            break;
         case 'q': // quit
             player.running = false;
             break;
         case 's': // set start
             player.start = player.pos;
             break;
+        case 't': // statistics
+            print_stats(arg.refblind, arg.blind || arg.refblind);
+            break;
         case 'x': // clear start
             player.start = 0;
             break;
+        case 'y': // cycle through tracks at loop seam
+            events.cycle = !events.cycle;
+            flush_events();
+            break;
         }
 
+        poll_watch();
+        poll_loader();
+        poll_governor();
+        poll_seam();
+        poll_cycle();
+        poll_export();
+        fflush(stdout);
         print_progress();
     }
 
@@ -649,4 +5458,7 @@ int main(int argc, char** argv) {
     if (arg.blind || arg.refblind) {
         print_files(false, false);
     }
+    if (arg.stats) {
+        print_stats(false, false);
+    }
 }